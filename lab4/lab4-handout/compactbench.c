@@ -0,0 +1,159 @@
+/*
+ * compactbench.c - shows how much of the heap mm_compact gives back to a
+ *     long-lived program whose working set shifts.
+ *
+ * The program goes through NUM_PHASES phases. Each phase allocates
+ * objects of random sizes up to the bytes of its working set, then frees
+ * them again, except for one in KEEP_EVERY, which lives until the end.
+ * Large and small working sets alternate, so the survivors of a large
+ * phase end up scattered over a heap far bigger than what is live.
+ *
+ * The phases run twice on the simulated heap of memlib.c: with
+ * mm_malloc/mm_free, and with mm_halloc/mm_hfree plus an mm_compact at
+ * the end of every phase. After every phase the size of both heaps is
+ * printed, along with the time mm_compact took. The payload of every
+ * handle is checked after each compaction.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define NUM_PHASES   8
+#define KEEP_EVERY   32      /* one object in this many survives its phase */
+#define MAX_OBJ      2048    /* largest object size */
+#define MAX_OBJS     (1 << 16)
+
+/* Bytes allocated by each phase */
+static const size_t phase_bytes[NUM_PHASES] = {
+    8 << 20, 1 << 20, 6 << 20, 512 << 10, 8 << 20, 1 << 20, 4 << 20, 256 << 10
+};
+
+/* Heap size after each phase, and the time mm_compact took (us) */
+typedef struct {
+    size_t live;
+    size_t heap;
+    double compact_us;
+} phase_t;
+
+static void run(int use_handles, phase_t *phases);
+static void check(void **handle, size_t size, int id);
+static double now_us(void);
+
+static void *objs[MAX_OBJS];     /* payloads, or handles with use_handles */
+static size_t sizes[MAX_OBJS];
+
+int main(int argc, char **argv)
+{
+    phase_t plain[NUM_PHASES], handles[NUM_PHASES];
+    int p;
+
+    mem_init();
+    run(0, plain);
+    run(1, handles);
+    mem_deinit();
+
+    printf("%5s %10s %12s %12s %12s\n", "phase", "live(KB)", "malloc(KB)", "handles(KB)", "compact(us)");
+    for (p = 0; p < NUM_PHASES; p++)
+        printf("%5d %10zu %12zu %12zu %12.0f\n", p, plain[p].live >> 10,
+               plain[p].heap >> 10, handles[p].heap >> 10, handles[p].compact_us);
+    exit(0);
+}
+
+/*
+ * run - Go through every phase, with handles or not, and record the heap
+ *     size after each one in phases
+ */
+static void run(int use_handles, phase_t *phases)
+{
+    int p, i, first, n = 0;
+    size_t bytes, live = 0;
+    double start;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed in run\n");
+        exit(1);
+    }
+    srand(208);
+
+    for (p = 0; p < NUM_PHASES; p++) {
+        /* allocate the working set of the phase, tagging every object with its id */
+        first = n;
+        for (bytes = 0; bytes < phase_bytes[p] && n < MAX_OBJS; bytes += sizes[n++]) {
+            sizes[n] = 1 + rand() % MAX_OBJ;
+            if (use_handles) {
+                void **h = mm_halloc(sizes[n]);
+                if (h == NULL) {
+                    fprintf(stderr, "mm_halloc failed in phase %d\n", p);
+                    exit(1);
+                }
+                memset(*h, n & 0xFF, sizes[n]);
+                objs[n] = h;
+            } else if ((objs[n] = mm_malloc(sizes[n])) == NULL) {
+                fprintf(stderr, "mm_malloc failed in phase %d\n", p);
+                exit(1);
+            }
+        }
+
+        /* free all of it but the survivors */
+        for (i = first; i < n; i++) {
+            if (i % KEEP_EVERY == 0) {
+                live += sizes[i];
+                continue;
+            }
+            if (use_handles)
+                mm_hfree(objs[i]);
+            else
+                mm_free(objs[i]);
+            objs[i] = NULL;
+        }
+
+        phases[p].compact_us = 0;
+        if (use_handles) {
+            start = now_us();
+            mm_compact();
+            phases[p].compact_us = now_us() - start;
+            for (i = 0; i < n; i++)
+                if (objs[i] != NULL)
+                    check(objs[i], sizes[i], i);
+        }
+        phases[p].live = live;
+        phases[p].heap = mem_heapsize();
+    }
+}
+
+/*
+ * check - Make sure a handle block kept its contents through compaction
+ */
+static void check(void **handle, size_t size, int id)
+{
+    unsigned char *p = *handle;
+    size_t i;
+
+    if ((size_t)p % 16 != 0) {
+        fprintf(stderr, "handle %d is not aligned after mm_compact\n", id);
+        exit(1);
+    }
+    for (i = 0; i < size; i++) {
+        if (p[i] != (id & 0xFF)) {
+            fprintf(stderr, "handle %d lost its contents in mm_compact\n", id);
+            exit(1);
+        }
+    }
+}
+
+/*
+ * now_us - The time in microseconds
+ */
+static double now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
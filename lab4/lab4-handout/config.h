@@ -32,6 +32,13 @@
   "binary-bal.rep",\
   "binary2-bal.rep"
 
+/*
+ * Traces that exercise realloc. mdriver-realloc runs these on top of
+ * DEFAULT_TRACEFILES; mdriver can not, since it has no REALLOC support.
+ */
+#define REALLOC_TRACEFILES \
+  "realloc-bal.rep",\
+  "realloc2-bal.rep"
 
 
 /*
@@ -61,11 +68,34 @@
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Maximum number of extra memlib regions (one per thread arena)
+ */
+#define MAX_REGIONS 16
+
+/*
+ * Set MEM_OS_BACKED to 1 to back memlib regions with real virtual memory:
+ * the whole region is reserved with mmap up front, pages are committed
+ * MEM_COMMIT_CHUNK bytes at a time as brk grows, and once brk shrinks
+ * MEM_TRIM_SIZE bytes below the committed end the pages above it are
+ * given back to the OS. With 0 the heap is modeled with one malloc'd
+ * array, where shrinking brk and mem_decommit release nothing; that is
+ * the default, since pages given back are faulted in again on every
+ * replay of a trace and the throughput would no longer compare with
+ * other allocators. "make mdriver-os" builds the driver with 1.
+ */
+#ifndef MEM_OS_BACKED
+#define MEM_OS_BACKED    0
+#endif
+#define MEM_COMMIT_CHUNK (64*(1<<10))   /* 64 KB */
+#define MEM_TRIM_SIZE    (256*(1<<10))  /* 256 KB */
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#define USE_BENCH  1   /* median of pinned CLOCK_MONOTONIC_RAW runs, with a CI (Linux) */
 
 #endif /* __CONFIG_H */
@@ -0,0 +1,165 @@
+/*
+ * fbench.c - Estimate the time (in seconds) used by a function f
+ *
+ * Every run of f is timed on its own with clock_gettime(CLOCK_MONOTONIC_RAW),
+ * which counts at a constant rate (on x86 it is read from the invariant TSC
+ * through the vDSO) and, unlike gettimeofday, is never stepped or slewed by
+ * NTP. After a few untimed warmup runs, which fault in the heap and fill the
+ * caches, f is run again and again until the 95% confidence interval of the
+ * median run time is within epsilon of the median, or the time budget is
+ * spent. The median is reported rather than the mean or the minimum: one run
+ * that was preempted does not move it, and it does not reward a lucky run.
+ *
+ * The confidence interval comes from the order statistics of the sorted runs
+ * and assumes nothing about their distribution: the median lies between the
+ * runs of rank n/2 - 0.98 sqrt(n) and 1 + n/2 + 0.98 sqrt(n) with 95% chance.
+ *
+ * While f is timed the calling thread is pinned to the CPU it is running on,
+ * so a migration does not cost a run its warm caches.
+ */
+#define _GNU_SOURCE     /* for sched_getcpu */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <sched.h>
+
+#include "fbench.h"
+
+/* Default values */
+#define PIN 1                /* pin the calling thread while timing */
+#define WARMUP 2             /* untimed runs before the timed ones */
+#define MIN_SAMPLES 15       /* always time at least this many runs */
+#define MAX_SAMPLES 501      /* ... and never more than this many */
+#define EPSILON 0.01         /* stop when the CI is within EPSILON of the median */
+#define MAX_SECS 0.5         /* ... or the timed runs took this long */
+#define Z95 1.96             /* quantile of the normal distribution for 95% */
+
+static int pin = PIN;
+static int warmup = WARMUP;
+static int min_samples = MIN_SAMPLES;
+static int max_samples = MAX_SAMPLES;
+static double epsilon = EPSILON;
+static double max_secs = MAX_SECS;
+
+static double now(void);
+static void insert_sorted(double *values, int n, double val);
+static void median_ci(double *values, int n, fbench_stats_t *stats);
+
+/*
+ * fbench - Time f(argp) as described at the top of the file and
+ *     return the median run time; stats (if not NULL) gets the rest
+ */
+double fbench(fbench_test_funct f, void *argp, fbench_stats_t *stats)
+{
+    fbench_stats_t result;
+    double *values, start, total = 0;
+    cpu_set_t old_set, one;
+    int i, n = 0, pinned = 0, cpu;
+
+    if ((values = malloc(max_samples * sizeof(double))) == NULL) {
+	fprintf(stderr, "fbench: out of memory\n");
+	exit(1);
+    }
+    if (pin && (cpu = sched_getcpu()) >= 0 &&
+	sched_getaffinity(0, sizeof(old_set), &old_set) == 0) {
+	CPU_ZERO(&one);
+	CPU_SET(cpu, &one);
+	pinned = sched_setaffinity(0, sizeof(one), &one) == 0;
+    }
+
+    for (i = 0; i < warmup; i++)
+	f(argp);
+
+    /* time runs until the median is known to within epsilon, or time is up */
+    do {
+	double secs;
+
+	start = now();
+	f(argp);
+	secs = now() - start;
+	insert_sorted(values, n++, secs);
+	total += secs;
+	median_ci(values, n, &result);
+    } while (n < max_samples &&
+	     (n < min_samples ||
+	      (total < max_secs && (result.ci_hi - result.median > epsilon * result.median ||
+				    result.median - result.ci_lo > epsilon * result.median))));
+
+    if (pinned)
+	sched_setaffinity(0, sizeof(old_set), &old_set);
+    free(values);
+    if (stats)
+	*stats = result;
+    return result.median;
+}
+
+/*
+ * set_fbench_xxx - Setters for the parameters of fbench
+ */
+void set_fbench_pin(int pin_arg)
+{
+    pin = pin_arg;
+}
+
+void set_fbench_warmup(int warmup_arg)
+{
+    warmup = warmup_arg;
+}
+
+void set_fbench_samples(int min_arg, int max_arg)
+{
+    min_samples = min_arg < 1 ? 1 : min_arg;
+    max_samples = max_arg < min_samples ? min_samples : max_arg;
+}
+
+void set_fbench_epsilon(double epsilon_arg)
+{
+    epsilon = epsilon_arg;
+}
+
+void set_fbench_max_secs(double secs)
+{
+    max_secs = secs;
+}
+
+/*
+ * now - The time in seconds on the raw monotonic clock
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * insert_sorted - Add val to the n sorted values, keeping them sorted
+ */
+static void insert_sorted(double *values, int n, double val)
+{
+    int i;
+
+    for (i = n; i > 0 && values[i-1] > val; i--)
+	values[i] = values[i-1];
+    values[i] = val;
+}
+
+/*
+ * median_ci - Fill in stats from the n sorted values: the median and
+ *     its 95% confidence interval from the order statistics
+ */
+static void median_ci(double *values, int n, fbench_stats_t *stats)
+{
+    double half = Z95 * sqrt(n) / 2;
+    int lo = (int) floor(n / 2.0 - half) - 1;    /* ranks count from 1, indexes from 0 */
+    int hi = (int) ceil(1 + n / 2.0 + half) - 1;
+
+    stats->samples = n;
+    stats->median = (n % 2) ? values[n/2] : (values[n/2 - 1] + values[n/2]) / 2;
+    stats->ci_lo = values[lo < 0 ? 0 : lo];
+    stats->ci_hi = values[hi > n - 1 ? n - 1 : hi];
+    stats->min = values[0];
+    stats->max = values[n-1];
+}
@@ -0,0 +1,59 @@
+/*
+ * fbench.h - prototypes for the routines in fbench.c that estimate the
+ *     running time (in seconds) of a test function f as the median of
+ *     many timed runs, with a confidence interval
+ */
+
+/* The test function takes a generic pointer as input */
+typedef void (*fbench_test_funct)(void *);
+
+/* What fbench measured: the median run and how far it can be trusted */
+typedef struct {
+    int samples;     /* timed runs */
+    double median;   /* median running time (secs) */
+    double ci_lo;    /* 95% confidence interval of the median (secs) */
+    double ci_hi;
+    double min;      /* fastest and slowest run (secs) */
+    double max;
+} fbench_stats_t;
+
+/* Estimate the running time of f(argp); stats may be NULL.
+   Return the median of the timed runs */
+double fbench(fbench_test_funct f, void *argp, fbench_stats_t *stats);
+
+/*********************************************************
+ * Set the various parameters used by fbench
+ *********************************************************/
+
+/*
+ * set_fbench_pin - When set, the calling thread runs on the CPU it is on
+ *     while f is timed, and may move again afterwards
+ *     Default = 1
+ */
+void set_fbench_pin(int pin);
+
+/*
+ * set_fbench_warmup - Number of untimed runs before the timed ones
+ *     Default = 2
+ */
+void set_fbench_warmup(int warmup);
+
+/*
+ * set_fbench_samples - Least and most number of timed runs
+ *     Default = 15, 501
+ */
+void set_fbench_samples(int min_samples, int max_samples);
+
+/*
+ * set_fbench_epsilon - Stop once the confidence interval of the median
+ *     is within epsilon of it on either side
+ *     Default = 0.01
+ */
+void set_fbench_epsilon(double epsilon);
+
+/*
+ * set_fbench_max_secs - Stop after the timed runs took this long in all,
+ *     as long as there are min_samples of them
+ *     Default = 0.5
+ */
+void set_fbench_max_secs(double secs);
@@ -6,9 +6,12 @@
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
+#include "fbench.h"
 #include "config.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
+static double last_secs, last_lo, last_hi;  /* the last measurement and its CI */
+static int last_samples;
 
 extern int verbose; /* -v option in mdriver.c */
 
@@ -36,6 +39,16 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_BENCH
+    if (verbose)
+	printf("Measuring performance with the median of pinned CLOCK_MONOTONIC_RAW runs.\n");
+
+    /* set key parameters for the fbench package */
+    set_fbench_pin(1);
+    set_fbench_warmup(2);
+    set_fbench_samples(15, 501);
+    set_fbench_epsilon(0.01);
+    set_fbench_max_secs(0.5);
 #endif
 }
 
@@ -44,14 +57,47 @@ void init_fsecs(void)
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
+#if USE_BENCH
+    fbench_stats_t stats;
+
+    last_secs = fbench(f, argp, &stats);
+    last_lo = stats.ci_lo;
+    last_hi = stats.ci_hi;
+    last_samples = stats.samples;
+    return last_secs;
+#else
 #if USE_FCYC
     double cycles = fcyc(f, argp);
-    return cycles/(Mhz*1e6);
+    last_secs = cycles/(Mhz*1e6);
 #elif USE_ITIMER
-    return ftimer_itimer(f, argp, 10);
+    last_secs = ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
-    return ftimer_gettod(f, argp, 10);
+    last_secs = ftimer_gettod(f, argp, 10);
 #endif 
+    last_lo = last_hi = last_secs;
+    last_samples = 10;
+    return last_secs;
+#endif
+}
+
+/*
+ * fsecs_spread - The confidence interval and number of runs of the last fsecs
+ */
+void fsecs_spread(double *lo, double *hi, int *samples)
+{
+    *lo = last_lo;
+    *hi = last_hi;
+    *samples = last_samples;
+}
+
+/*
+ * set_fsecs_pin - Whether the benchmark timer pins the thread it times
+ */
+void set_fsecs_pin(int pin)
+{
+#if USE_BENCH
+    set_fbench_pin(pin);
+#endif
 }
 
 
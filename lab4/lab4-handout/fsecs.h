@@ -2,3 +2,11 @@ typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+
+/* The 95% confidence interval (secs) and the number of timed runs of the
+   last fsecs call; the interval is empty for timers that only average */
+void fsecs_spread(double *lo, double *hi, int *samples);
+
+/* Whether fsecs pins the calling thread to its CPU while it times f
+   (only the benchmark timer pins; turn it off when f starts threads) */
+void set_fsecs_pin(int pin);
@@ -97,7 +97,7 @@ static char tracedir[MAXLINE] = TRACEDIR;
 
 /* The filenames of the default tracefiles */
 static char *default_tracefiles[] = {  
-                                     DEFAULT_TRACEFILES, NULL
+                                     DEFAULT_TRACEFILES, REALLOC_TRACEFILES, NULL
 };
 
 
@@ -366,9 +366,8 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap (or one of mm's mappings) */
+    if (!mem_contains(lo, size)) {
         sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
                 lo, hi, mem_heap_lo(), mem_heap_hi());
         malloc_error(tracenum, opnum, msg);
@@ -447,7 +446,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     FILE *tracefile;
     trace_t *trace;
     char type[MAXLINE];
-    char path[MAXLINE];
+    char path[MAXLINE / 2]; // hack to get rid of overflow warning in the sprintf below
     int index, size;
     int max_index = 0;
     int op_index;
@@ -625,7 +624,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
             oldsize = trace->block_sizes[index];
             if (size < oldsize) oldsize = size;
             for (j = 0; j < oldsize; j++) {
-                if (newp[j] != (index & 0xFF)) {
+                if ((unsigned char)newp[j] != (index & 0xFF)) {
                     malloc_error(tracenum, i, "mm_realloc did not preserve the "
                                  "data from old block");
                     return 0;
@@ -660,11 +659,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
- *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   Utilization is the ratio hwm/heapsize, where heapsize is the
+ *   largest size the heap reached while running the student's malloc
+ *   package on the trace (mem_heap_peak). mem_sbrk() lets the heap
+ *   shrink again, so the size of the heap at the end would not do. 
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
@@ -746,7 +744,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_heap_peak());
 }
 
 
@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE     /* for sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -14,7 +15,14 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <limits.h>
 #include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sched.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -29,6 +37,17 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define TRACE_MAGIC "mdtrace1" /* first bytes of a cached binary trace */
+#define TRACE_SUFFIX ".bin"    /* the cache of foo.rep is foo.rep.bin */
+#define MAX_THREADS   16 /* max threads for -T (one mm arena each) */
+#define REMOTE_EVERY   4 /* in -T mode, every 4th free is done by another thread */
+#define DRAIN_EVERY   64 /* in -T mode, threads free their handed-over blocks every 64 ops */
+
+/* Per-call latency histograms (-L) */
+#define LAT_SUB_BITS   4  /* 16 linear buckets per power of two ns: within 6.25% */
+#define LAT_BUCKETS    ((64 - LAT_SUB_BITS + 1) << LAT_SUB_BITS)
+#define LAT_CALLS      2  /* mm_malloc, mm_free */
+#define LAT_CLASSES    5  /* payload size classes, see lat_class */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((size_t)(p)) % ALIGNMENT) == 0)
@@ -37,31 +56,64 @@
  * The key compound data types
  *****************************/
 
-/* Records the extent of each block's payload */
+/*
+ * Records the extent of each block's payload. The records of the
+ * allocated blocks form a treap ordered by lo, so a new block only has
+ * to be checked against its two neighbours. The priority of a record is
+ * a hash of lo, so the tree's shape does not depend on the order in
+ * which blocks were allocated.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* records of lower payloads */
+    struct range_t *right; /* records of higher payloads */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc request */
-} traceop_t;
+#define RANGE_PRIO(p) ((((size_t)(p)->lo) * 0x9E3779B97F4A7C15UL) >> 32)
 
-/* Holds the information for one trace file*/
+/*
+ * The type of a single trace operation (allocator request). A batch
+ * line of a trace ("A id n size" or "F id n") becomes n requests for
+ * the blocks id, ..., id+n-1: the first one is an ALLOC_BATCH or
+ * FREE_BATCH and the other n-1 are BATCH_MORE.
+ */
+enum {ALLOC, FREE, REALLOC, ALLOC_BATCH, FREE_BATCH, BATCH_MORE};
+
+/*
+ * Holds the information for one trace file. The requests are kept as
+ * three parallel arrays, which is also their layout in the binary cache
+ * file, so a cached trace is used straight from its mapping.
+ */
 typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
     int num_ids;         /* number of alloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
+    char *types;         /* type of each request */
+    int *ids;            /* id of the block each request is for */
+    int *sizes;          /* byte size of each alloc/realloc request */
+    void *map;           /* cache file the arrays point into (NULL if malloc'd) */
+    size_t map_size;
     char **blocks;       /* array of ptrs returned by malloc */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
 } trace_t;
 
+/*
+ * Header of a cached binary trace. It is followed by the ids, sizes and
+ * types arrays, num_ops entries each. The size and mtime of the .rep
+ * tell whether the cache is stale.
+ */
+typedef struct {
+    char magic[8];
+    long long rep_size;
+    long long rep_mtime; /* in ns */
+    int sugg_heapsize;
+    int num_ids;
+    int num_ops;
+    int weight;
+} tracebin_t;
+
 /*
  * Holds the params to the xxx_speed functions, which are timed by fcyc.
  * This struct is necessary because fcyc accepts only a pointer array
@@ -72,24 +124,80 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/*
+ * One thread of the multi-threaded speed test. Every thread replays the
+ * whole trace in its own arena; some of its frees are handed to the next
+ * thread's mailbox, so they reach mm_free from a thread that does not own them.
+ */
+typedef struct mt_thread {
+    trace_t *trace;
+    char **blocks;           /* this thread's ptrs returned by malloc */
+    char **mailbox;          /* blocks other threads want this thread to free */
+    int mailbox_count;
+    pthread_mutex_t mailbox_lock;
+    struct mt_thread *next;  /* thread that gets this thread's remote frees */
+    pthread_barrier_t *done; /* every thread is done replaying the trace */
+} mt_thread_t;
+
+/* Holds the params to eval_mm_mt_speed, which is timed by fsecs */
+typedef struct {
+    int num_threads;
+    mt_thread_t *threads;
+} mt_speed_t;
+
+/* Latency percentiles of one kind of call, in ns */
+typedef struct {
+    size_t count;
+    double p50, p99, p999, max;
+} latency_t;
+
+/* Log-linear latency histogram (HDR style): bucket i < 16 holds i ns, and
+ * every power of two above is split into 16 equal buckets */
+typedef struct {
+    size_t counts[LAT_BUCKETS];
+    size_t total;
+    unsigned long max;
+} histogram_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    double secs_lo;  /* 95% confidence interval of secs, */
+    double secs_hi;  /* ... as far as the timer gives one */
+    int samples;     /* timed runs of the trace */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    size_t cache_lookups; /* small mallocs that looked in mm's small-block cache */
+    size_t cache_hits;    /* ... and were served from it (both from the util pass) */
+    size_t heap_peak;     /* largest heap size during the util pass (bytes) */
+    size_t heap_end;      /* heap size at the end of the util pass (bytes) */
+    size_t heap_resident; /* ... and how much of the heap is still backed by pages */
+    latency_t latency[LAT_CALLS][LAT_CLASSES + 1]; /* per call and size class, then all sizes (-L) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
 
+/* What a -j worker process sends back for each trace it evaluated */
+typedef struct {
+    int tracenum;
+    int errors;      /* errors reported while evaluating the trace */
+    stats_t stats;
+} result_msg_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int latency = 0; /* if set, time every mm call of each trace (set by -L) */
+static char *json_file = NULL;     /* if set, write the mm results as JSON to this file (-J) */
+static char *timeline_file = NULL; /* if set, write heap snapshots to this CSV file (-H) */
+static int timeline_every = 1000;  /* ... every this many ops of the util pass (-i) */
+static int unbatch = 0; /* if set, replay batch requests as single calls (set by -b) */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -105,15 +213,22 @@ static char *default_tracefiles[] = {
  * Function prototypes
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size,
                      int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static void insert_range(range_t **ranges, range_t *r);
+static range_t *merge_ranges(range_t *left, range_t *right);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void parse_trace(trace_t *trace, char *path);
+static int map_trace(trace_t *trace, char *binpath, struct stat *rep_stat);
+static void save_trace(trace_t *trace, char *binpath, struct stat *rep_stat);
 static void free_trace(trace_t *trace);
+static void unbatch_trace(trace_t *trace);
+static int batch_len(trace_t *trace, int i);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
@@ -124,9 +239,32 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_mt_speed(void *ptr);
+static void *mt_replay(void *ptr);
+static void mt_drain(mt_thread_t *thread);
+static double eval_mm_mt(trace_t *trace, int num_threads);
+static void eval_mm_trace(int tracenum, char *tracefile, stats_t *stats, range_t **ranges);
+static void eval_mm_latency(trace_t *trace, stats_t *stats);
+static int lat_class(int size);
+static unsigned long lat_now(void);
+static void hist_add(histogram_t *hist, unsigned long ns);
+static double hist_percentile(histogram_t *hist, double fraction);
+static void eval_mm_parallel(int n, char **tracefiles, stats_t *stats, int jobs);
+static int num_cpus(void);
+static void pin_to_cpu(int worker);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printcacheresults(int n, stats_t *stats);
+static void printheapresults(int n, stats_t *stats);
+static void printlatencyresults(int n, stats_t *stats);
+static void write_snapshot(FILE *out, int tracenum, int opnum, int payload);
+static void merge_timeline(int n);
+static void saveresults(char *filename, int n, char **tracefiles, stats_t *stats);
+static void compareresults(char *filename, int n, char **tracefiles, stats_t *stats);
+static void writejson(char *filename, int n, char **tracefiles, stats_t *stats,
+                      double perfindex);
+static double ci_percent(stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -149,7 +287,11 @@ int main(int argc, char **argv)
 
     int team_check = 0;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
+    int max_threads = 0; /* If set, run the multi-threaded speed test (set by -T) */
+    int jobs = 1;        /* Number of traces evaluated at once in worker processes (-j) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    char *save_file = NULL;    /* If set, save the mm results to this file (-s) */
+    char *compare_file = NULL; /* If set, compare the mm results with this file (-c) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +300,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:T:j:s:c:H:J:i:hvVgablL")) != EOF) {
         switch (c) {
         case 'g': /* Generate summary info for the autograder */
             autograder = 1;
@@ -181,9 +323,48 @@ int main(int argc, char **argv)
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
+        case 'b': /* Replay batch requests as single mm_malloc/mm_free calls */
+            unbatch = 1;
+            break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'T': /* Replay each trace concurrently in up to this many threads */
+            max_threads = atoi(optarg);
+            if (max_threads < 1 || max_threads > MAX_THREADS) {
+                fprintf(stderr, "-T takes a thread count between 1 and %d\n", MAX_THREADS);
+                exit(1);
+            }
+            break;
+        case 'j': /* Evaluate this many traces at once, each in its own pinned process */
+            jobs = atoi(optarg);
+            if (jobs < 1) {
+                fprintf(stderr, "-j takes a positive number of worker processes\n");
+                exit(1);
+            }
+            break;
+        case 's': /* Save the per-trace mm results for a later -c run */
+            save_file = optarg;
+            break;
+        case 'c': /* Compare the per-trace mm results with a file saved by -s */
+            compare_file = optarg;
+            break;
+        case 'J': /* Write the mm results and the perf index as JSON to this file */
+            json_file = optarg;
+            break;
+        case 'H': /* Write a CSV timeline of mm's heap snapshots to this file */
+            timeline_file = optarg;
+            break;
+        case 'i': /* Take a heap snapshot every this many ops */
+            timeline_every = atoi(optarg);
+            if (timeline_every < 1) {
+                fprintf(stderr, "-i takes a positive number of ops\n");
+                exit(1);
+            }
+            break;
+        case 'L': /* Print latency percentiles of every kind of mm call */
+            latency = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -253,6 +434,7 @@ int main(int argc, char **argv)
         /* Evaluate the libc malloc package using the K-best scheme */
         for (i=0; i < num_tracefiles; i++) {
             trace = read_trace(tracedir, tracefiles[i]);
+            unbatch_trace(trace);   /* libc has no batch calls */
             libc_stats[i].ops = trace->num_ops;
             if (verbose > 1)
                 printf("Checking libc malloc for correctness, ");
@@ -262,6 +444,8 @@ int main(int argc, char **argv)
                 if (verbose > 1)
                     printf("and performance.\n");
                 libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+                fsecs_spread(&libc_stats[i].secs_lo, &libc_stats[i].secs_hi,
+                             &libc_stats[i].samples);
             }
             free_trace(trace);
         }
@@ -288,30 +472,55 @@ int main(int argc, char **argv)
     mem_init();
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-        trace = read_trace(tracedir, tracefiles[i]);
-        mm_stats[i].ops = trace->num_ops;
-        if (verbose > 1)
-            printf("Checking mm_malloc for correctness, ");
-        mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-        if (mm_stats[i].valid) {
-            if (verbose > 1)
-                printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-            speed_params.trace = trace;
-            speed_params.ranges = ranges;
-            if (verbose > 1)
-                printf("and performance.\n");
-            mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-        }
-        free_trace(trace);
-    }
+    if (jobs > 1)
+        eval_mm_parallel(num_tracefiles, tracefiles, mm_stats, jobs);
+    else
+        for (i=0; i < num_tracefiles; i++)
+            eval_mm_trace(i, tracefiles[i], &mm_stats[i], &ranges);
+
+    if (timeline_file)
+        merge_timeline(num_tracefiles);
 
     /* Display the mm results in a compact table */
     if (verbose) {
         printf("\nResults for mm malloc:\n");
         printresults(num_tracefiles, mm_stats);
         printf("\n");
+        printcacheresults(num_tracefiles, mm_stats);
+        printheapresults(num_tracefiles, mm_stats);
+    }
+    if (latency)
+        printlatencyresults(num_tracefiles, mm_stats);
+    if (save_file)
+        saveresults(save_file, num_tracefiles, tracefiles, mm_stats);
+    if (compare_file)
+        compareresults(compare_file, num_tracefiles, tracefiles, mm_stats);
+
+    /*
+     * Optionally replay every trace in 1, 2, 4, ... max_threads threads at once,
+     * each with its own mm arena, and report how the aggregate throughput scales
+     */
+    if (max_threads) {
+        int num_threads;
+
+        printf("Results for mm malloc with one arena per thread:\n");
+        printf("%5s%8s%8s%10s%8s\n", "trace", "threads", "ops", "secs", "Kops");
+        for (i=0; i < num_tracefiles; i++) {
+            if (!mm_stats[i].valid)
+                continue;
+            trace = read_trace(tracedir, tracefiles[i]);
+            for (num_threads = 1; ; num_threads *= 2) {
+                if (num_threads > max_threads)
+                    num_threads = max_threads;
+                secs = eval_mm_mt(trace, num_threads);
+                ops = (double)trace->num_ops * num_threads;
+                printf("%2d%10d%8.0f%10.6f%8.0f\n", i, num_threads, ops, secs, (ops/1e3)/secs);
+                if (num_threads == max_threads)
+                    break;
+            }
+            free_trace(trace);
+        }
+        printf("\n");
     }
 
     /*
@@ -358,6 +567,9 @@ int main(int argc, char **argv)
         printf("Terminated with %d errors\n", errors);
     }
 
+    if (json_file)
+        writejson(json_file, num_tracefiles, tracefiles, mm_stats, perfindex);
+
     if (autograder) {
         printf("correct:%d\n", numcorrect);
         printf("perfidx:%.0f\n", perfindex);
@@ -368,22 +580,22 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps
+ * The following routines manipulate the range tree, which keeps
  * track of the extent of every allocated block payload. We use the
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list.
+ *     we create a range struct for this block and add it to the range tree.
  */
 static int add_range(range_t **ranges, char *lo, int size,
                      int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *pred = NULL, *succ = NULL;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -396,56 +608,110 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap (or one of mm's mappings) */
+    if (!mem_contains(lo, size)) {
         sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
                 lo, hi, mem_heap_lo(), mem_heap_hi());
         malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-            sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                    lo, hi, p->lo, p->hi);
-            malloc_error(tracenum, opnum, msg);
-            return 0;
+    /*
+     * The payload must not overlap any other payloads. Those do not
+     * overlap each other, so only the last payload that starts at or
+     * below lo and the first one above it can overlap this one.
+     */
+    for (p = *ranges;  p != NULL; ) {
+        if (p->lo <= lo) {
+            pred = p;
+            p = p->right;
+        } else {
+            succ = p;
+            p = p->left;
         }
     }
+    p = NULL;
+    if (pred != NULL && pred->hi >= lo)
+        p = pred;
+    else if (succ != NULL && succ->lo <= hi)
+        p = succ;
+    if (p != NULL) {
+        sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                lo, hi, p->lo, p->hi);
+        malloc_error(tracenum, opnum, msg);
+        return 0;
+    }
 
     /*
      * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
         unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->left = p->right = NULL;
+    insert_range(ranges, p);
     return 1;
 }
 
+/*
+ * insert_range - Add record r below the subtree root *ranges, and rotate
+ *     it up past every record of lower priority.
+ */
+static void insert_range(range_t **ranges, range_t *r)
+{
+    range_t *root = *ranges;
+
+    if (root == NULL) {
+        *ranges = r;
+    } else if (r->lo < root->lo) {
+        insert_range(&root->left, r);
+        if (RANGE_PRIO(root->left) > RANGE_PRIO(root)) {
+            *ranges = root->left;
+            root->left = (*ranges)->right;
+            (*ranges)->right = root;
+        }
+    } else {
+        insert_range(&root->right, r);
+        if (RANGE_PRIO(root->right) > RANGE_PRIO(root)) {
+            *ranges = root->right;
+            root->right = (*ranges)->left;
+            (*ranges)->left = root;
+        }
+    }
+}
+
+/*
+ * merge_ranges - Join two subtrees, where every record in left is below
+ *     every record in right, into one
+ */
+static range_t *merge_ranges(range_t *left, range_t *right)
+{
+    if (left == NULL)
+        return right;
+    if (right == NULL)
+        return left;
+    if (RANGE_PRIO(left) > RANGE_PRIO(right)) {
+        left->right = merge_ranges(left->right, right);
+        return left;
+    }
+    right->left = merge_ranges(left, right->left);
+    return right;
+}
+
 /*
  * remove_range - Free the range record of block whose payload starts at lo
  */
 static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
-    // int size;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-            *prevpp = p->next;
-            // size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    while ((p = *ranges) != NULL && p->lo != lo)
+        ranges = (lo < p->lo) ? &p->left : &p->right;
+    if (p != NULL) {
+        *ranges = merge_ranges(p->left, p->right);
+        free(p);
     }
 }
 
@@ -454,13 +720,11 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
-
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (*ranges == NULL)
+        return;
+    clear_ranges(&(*ranges)->left);
+    clear_ranges(&(*ranges)->right);
+    free(*ranges);
     *ranges = NULL;
 }
 
@@ -470,45 +734,40 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. A trace is
+ *     parsed only the first time; its binary cache beside the .rep file
+ *     is mapped read-only on later runs.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
     char path[MAXLINE / 2]; // hack to get rid of overflow warning on line 496
-    int index, size;
-    int max_index = 0;
-    int op_index;
-    int scan_result = 1;
-
-    if (verbose > 1)
-        printf("Reading tracefile: %s\n", filename);
+    char binpath[MAXLINE];
+    struct stat rep_stat;
+    int cached;
 
     /* Allocate the trace record */
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
         unix_error("malloc 1 failed in read_trance");
 
-    /* Read the trace file header */
     strcpy(path, tracedir);
     strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
+    strcpy(binpath, path);
+    strcat(binpath, TRACE_SUFFIX);
+    if (stat(path, &rep_stat) < 0) {
         sprintf(msg, "Could not open %s in read_trace", path);
         unix_error(msg);
     }
-    scan_result = scan_result && fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    scan_result = scan_result && fscanf(tracefile, "%d", &(trace->num_ids));
-    scan_result = scan_result && fscanf(tracefile, "%d", &(trace->num_ops));
-    scan_result = scan_result && fscanf(tracefile, "%d", &(trace->weight));        /* not used */
-    if (!scan_result) {
-        printf("Error scanning metadata at the start of the trace\n");
-        exit(1);
+
+    cached = map_trace(trace, binpath, &rep_stat);
+    if (verbose > 1)
+        printf("Reading tracefile: %s%s\n", filename, cached ? " (cached)" : "");
+    if (!cached) {
+        parse_trace(trace, path);
+        save_trace(trace, binpath, &rep_stat);
     }
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops =
-         (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-        unix_error("malloc 2 failed in read_trace");
+    if (unbatch)
+        unbatch_trace(trace);
 
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks =
@@ -520,29 +779,94 @@ static trace_t *read_trace(char *tracedir, char *filename)
          (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
         unix_error("malloc 4 failed in read_trace");
 
+    return trace;
+}
+
+/*
+ * parse_trace - read the requests of a .rep trace file into malloc'd arrays
+ */
+static void parse_trace(trace_t *trace, char *path)
+{
+    FILE *tracefile;
+    char type[MAXLINE];
+    int index, size, count, j;
+    int max_index = 0;
+    int op_index;
+    int scan_result = 1;
+
+    /* Read the trace file header */
+    if ((tracefile = fopen(path, "r")) == NULL) {
+        sprintf(msg, "Could not open %s in read_trace", path);
+        unix_error(msg);
+    }
+    scan_result = scan_result && fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+    scan_result = scan_result && fscanf(tracefile, "%d", &(trace->num_ids));
+    scan_result = scan_result && fscanf(tracefile, "%d", &(trace->num_ops));
+    scan_result = scan_result && fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    if (!scan_result) {
+        printf("Error scanning metadata at the start of the trace\n");
+        exit(1);
+    }
+    /* We'll store each request line in the trace in these arrays */
+    trace->map = NULL;
+    trace->map_size = 0;
+    if ((trace->types = (char *)malloc(trace->num_ops)) == NULL ||
+        (trace->ids = (int *)malloc(trace->num_ops * sizeof(int))) == NULL ||
+        (trace->sizes = (int *)malloc(trace->num_ops * sizeof(int))) == NULL)
+        unix_error("malloc 2 failed in read_trace");
+
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
+        if (op_index >= trace->num_ops) {
+            printf("More requests than the %d in the header of %s\n",
+                   trace->num_ops, path);
+            exit(1);
+        }
         switch(type[0]) {
         case 'a':
             scan_result = scan_result && fscanf(tracefile, "%u %u", &index, &size);
-            trace->ops[op_index].type = ALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
+            trace->types[op_index] = ALLOC;
+            trace->ids[op_index] = index;
+            trace->sizes[op_index] = size;
             max_index = (index > max_index) ? index : max_index;
             break;
         case 'r':
             scan_result = scan_result && fscanf(tracefile, "%u %u", &index, &size);
-            trace->ops[op_index].type = REALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
+            trace->types[op_index] = REALLOC;
+            trace->ids[op_index] = index;
+            trace->sizes[op_index] = size;
             max_index = (index > max_index) ? index : max_index;
             break;
         case 'f':
             scan_result = scan_result && fscanf(tracefile, "%ud", &index);
-            trace->ops[op_index].type = FREE;
-            trace->ops[op_index].index = index;
+            trace->types[op_index] = FREE;
+            trace->ids[op_index] = index;
+            trace->sizes[op_index] = 0;
+            break;
+        case 'A':
+        case 'F':
+            count = 1;
+            size = 0;
+            if (type[0] == 'A')
+                scan_result = scan_result && fscanf(tracefile, "%u %u %u", &index, &count, &size) == 3;
+            else
+                scan_result = scan_result && fscanf(tracefile, "%u %u", &index, &count) == 2;
+            if (count < 1 || op_index + count > trace->num_ops) {
+                printf("Bad batch of %d requests at request %d of %s\n",
+                       count, op_index, path);
+                exit(1);
+            }
+            for (j = 0; j < count; j++) {
+                trace->types[op_index + j] = (j > 0) ? BATCH_MORE :
+                    (type[0] == 'A') ? ALLOC_BATCH : FREE_BATCH;
+                trace->ids[op_index + j] = index + j;
+                trace->sizes[op_index + j] = size;
+            }
+            if (type[0] == 'A')
+                max_index = (index + count - 1 > max_index) ? index + count - 1 : max_index;
+            op_index += count - 1;
             break;
         default:
             printf("Bogus type character (%c) in tracefile %s\n",
@@ -559,22 +883,142 @@ static trace_t *read_trace(char *tracedir, char *filename)
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
+}
 
-    return trace;
+/*
+ * map_trace - map the binary cache of a trace. Returns 0 if
+ *     there is no cache, or it was not made from this version of the .rep.
+ */
+static int map_trace(trace_t *trace, char *binpath, struct stat *rep_stat)
+{
+    int fd;
+    struct stat bin_stat;
+    tracebin_t *hdr;
+    char *map;
+    size_t n;
+
+    if ((fd = open(binpath, O_RDONLY)) < 0)
+        return 0;
+    if (fstat(fd, &bin_stat) < 0 || (size_t)bin_stat.st_size < sizeof(tracebin_t)) {
+        close(fd);
+        return 0;
+    }
+    /* writable but private, so unbatch_trace can rewrite the types */
+    map = mmap(NULL, bin_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+
+    hdr = (tracebin_t *)map;
+    n = hdr->num_ops;
+    if (memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->rep_size != (long long)rep_stat->st_size ||
+        hdr->rep_mtime != rep_stat->st_mtim.tv_sec * 1000000000LL + rep_stat->st_mtim.tv_nsec ||
+        hdr->num_ops < 0 || hdr->num_ids < 1 ||
+        (size_t)bin_stat.st_size != sizeof(tracebin_t) + n * (2 * sizeof(int) + 1)) {
+        munmap(map, bin_stat.st_size);
+        return 0;
+    }
+
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->ids = (int *)(map + sizeof(tracebin_t));
+    trace->sizes = trace->ids + n;
+    trace->types = (char *)(trace->sizes + n);
+    trace->map = map;
+    trace->map_size = bin_stat.st_size;
+    return 1;
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * save_trace - write the binary cache of a parsed trace. The cache is
+ *     written under a temporary name and renamed into place, so a reader
+ *     never maps half a file. Failing to write it (say, in a read-only
+ *     trace directory) is not an error; the trace is just parsed again
+ *     next time.
+ */
+static void save_trace(trace_t *trace, char *binpath, struct stat *rep_stat)
+{
+    FILE *binfile;
+    tracebin_t hdr;
+    char tmppath[MAXLINE + 32];
+    size_t n = trace->num_ops;
+    int ok;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.rep_size = rep_stat->st_size;
+    hdr.rep_mtime = rep_stat->st_mtim.tv_sec * 1000000000LL + rep_stat->st_mtim.tv_nsec;
+    hdr.sugg_heapsize = trace->sugg_heapsize;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.weight = trace->weight;
+
+    sprintf(tmppath, "%s.%d", binpath, (int)getpid());
+    if ((binfile = fopen(tmppath, "w")) == NULL)
+        return;
+    ok = fwrite(&hdr, sizeof(hdr), 1, binfile) == 1 &&
+        fwrite(trace->ids, sizeof(int), n, binfile) == n &&
+        fwrite(trace->sizes, sizeof(int), n, binfile) == n &&
+        fwrite(trace->types, 1, n, binfile) == n;
+    ok = (fclose(binfile) == 0) && ok;
+    if (!ok || rename(tmppath, binpath) < 0)
+        unlink(tmppath);
+}
+
+/*
+ * free_trace - Free the trace record, its request arrays (or the
+ *              mapping they live in) and the block arrays.
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);
+    if (trace->map != NULL)   /* unmap the cached requests... */
+        munmap(trace->map, trace->map_size);
+    else {
+        free(trace->types);
+        free(trace->ids);
+        free(trace->sizes);
+    }
+    free(trace->blocks);      /* ... free the block arrays... */
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
 }
 
+/*
+ * unbatch_trace - turn the batch requests of a trace into single
+ *     ALLOC and FREE requests (-b, and for libc malloc)
+ */
+static void unbatch_trace(trace_t *trace)
+{
+    int i;
+    char type = ALLOC;
+
+    for (i = 0; i < trace->num_ops; i++) {
+        if (trace->types[i] == ALLOC_BATCH)
+            type = ALLOC;
+        else if (trace->types[i] == FREE_BATCH)
+            type = FREE;
+        else if (trace->types[i] != BATCH_MORE)
+            continue;
+        trace->types[i] = type;
+    }
+}
+
+/*
+ * batch_len - the number of requests in the batch that starts with
+ *     request i
+ */
+static int batch_len(trace_t *trace, int i)
+{
+    int n = 1;
+
+    while (i + n < trace->num_ops && trace->types[i + n] == BATCH_MORE)
+        n++;
+    return n;
+}
+
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
  * and throughput of the libc and mm malloc packages.
@@ -585,12 +1029,12 @@ void free_trace(trace_t *trace)
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 {
-    int i;
+    int i, j, n;
     int index;
     int size;
     char *p;
 
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -602,10 +1046,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
     /* Interpret each operation in the trace in order */
     for (i = 0;  i < trace->num_ops;  i++) {
-        index = trace->ops[i].index;
-        size = trace->ops[i].size;
+        index = trace->ids[i];
+        size = trace->sizes[i];
 
-        switch (trace->ops[i].type) {
+        switch (trace->types[i]) {
 
         case ALLOC: /* mm_malloc */
 
@@ -617,7 +1061,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
             /*
              * Test the range of the new block for correctness and add it
-             * to the range list if OK. The block must be  be aligned properly,
+             * to the range tree if OK. The block must be  be aligned properly,
              * and must not overlap any currently allocated block.
              */
             if (add_range(ranges, p, size, tracenum, i) == 0)
@@ -635,14 +1079,38 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
             trace->block_sizes[index] = size;
             break;
 
+        case ALLOC_BATCH: /* mm_malloc_batch, into blocks[index..index+n-1] */
+            n = batch_len(trace, i);
+            if (mm_malloc_batch(size, (void **)&trace->blocks[index], n) != n) {
+                malloc_error(tracenum, i, "mm_malloc_batch failed.");
+                return 0;
+            }
+            for (j = 0; j < n; j++) {
+                p = trace->blocks[index + j];
+                if (add_range(ranges, p, size, tracenum, i + j) == 0)
+                    return 0;
+                memset(p, (index + j) & 0xFF, size);
+                trace->block_sizes[index + j] = size;
+            }
+            i += n - 1;
+            break;
+
         case FREE: /* mm_free */
 
-            /* Remove region from list and call student's free function */
+            /* Remove region from tree and call student's free function */
             p = trace->blocks[index];
             remove_range(ranges, p);
             mm_free(p);
             break;
 
+        case FREE_BATCH: /* mm_free_batch, which may reorder the blocks it frees */
+            n = batch_len(trace, i);
+            for (j = 0; j < n; j++)
+                remove_range(ranges, trace->blocks[index + j]);
+            mm_free_batch((void **)&trace->blocks[index], n);
+            i += n - 1;
+            break;
+
         default:
             app_error("Nonexistent request type in eval_mm_valid");
         }
@@ -658,32 +1126,43 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   largest size the heap reached while running the student's malloc
+ *   package on the trace (mem_heap_peak). mem_sbrk() lets the heap
+ *   shrink again, so the size of the heap at the end would not do.
  *
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 {
-    int i;
+    int i, j, n;
     int index;
     int size;
     int max_total_size = 0;
     int total_size = 0;
     char *p;
+    FILE *timeline = NULL;
+    char path[MAXLINE];
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
     if (mm_init() < 0)
         app_error("mm_init failed in eval_mm_util");
 
+    /* each trace's part of the -H timeline goes to a file of its own first */
+    if (timeline_file) {
+        sprintf(path, "%s.%d", timeline_file, tracenum);
+        if ((timeline = fopen(path, "w")) == NULL)
+            unix_error("Could not open the heap timeline in eval_mm_util");
+        write_snapshot(timeline, -1, 0, 0);
+    }
+
     for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+        if (timeline && i % timeline_every == 0)
+            write_snapshot(timeline, tracenum, i, total_size);
+        switch (trace->types[i]) {
 
         case ALLOC: /* mm_alloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = trace->ids[i];
+            size = trace->sizes[i];
 
             if ((p = mm_malloc(size)) == NULL)
                 app_error("mm_malloc failed in eval_mm_util");
@@ -701,8 +1180,24 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
                 total_size : max_total_size;
             break;
 
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            index = trace->ids[i];
+            size = trace->sizes[i];
+            n = batch_len(trace, i);
+
+            if (mm_malloc_batch(size, (void **)&trace->blocks[index], n) != n)
+                app_error("mm_malloc_batch failed in eval_mm_util");
+            for (j = 0; j < n; j++)
+                trace->block_sizes[index + j] = size;
+
+            total_size += n * size;
+            max_total_size = (total_size > max_total_size) ?
+                total_size : max_total_size;
+            i += n - 1;
+            break;
+
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = trace->ids[i];
             size = trace->block_sizes[index];
             p = trace->blocks[index];
 
@@ -714,23 +1209,105 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
             break;
 
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ids[i];
+            n = batch_len(trace, i);
+
+            for (j = 0; j < n; j++)
+                total_size -= trace->block_sizes[index + j];
+            mm_free_batch((void **)&trace->blocks[index], n);
+            i += n - 1;
+            break;
+
         default:
             app_error("Nonexistent request type in eval_mm_util");
 
         }
     }
+    if (timeline) {
+        write_snapshot(timeline, tracenum, trace->num_ops, total_size);
+        fclose(timeline);
+    }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_heap_peak());
 }
 
 
+/*
+ * write_snapshot - Take a snapshot of mm's heap after opnum ops, with
+ *     payload bytes allocated, and write it as a line of the -H timeline.
+ *     With tracenum -1, write the header line instead.
+ */
+static void write_snapshot(FILE *out, int tracenum, int opnum, int payload)
+{
+    mm_heap_t snap;
+    int k;
+
+    mm_heap_snapshot(&snap);
+    if (tracenum < 0) {
+        fprintf(out, "trace,op,payload,heap,util,alloc_blocks,alloc_bytes,header_bytes,padding,"
+                "cached_blocks,cached_bytes,free_blocks,free_bytes,largest_free,ext_frag,"
+                "mapped_blocks,mapped_bytes");
+        for (k = 0; k < MM_HEAP_BUCKETS; k++)
+            fprintf(out, ",free_2^%d", k);
+        for (k = 0; k < snap.num_classes; k++)
+            fprintf(out, ",list_%d", k);
+        fprintf(out, "\n");
+        return;
+    }
+
+    /* padding: what allocated blocks hold beyond their headers and payloads */
+    fprintf(out, "%d,%d,%d,%zu,%.4f,%zu,%zu,%zu,%zd,%zu,%zu,%zu,%zu,%zu,%.4f,%zu,%zu",
+            tracenum, opnum, payload, snap.heap_bytes,
+            (double)payload / (snap.heap_bytes + snap.mapped_bytes),
+            snap.alloc_blocks, snap.alloc_bytes, snap.header_bytes,
+            (ssize_t)(snap.alloc_bytes - snap.header_bytes + snap.mapped_bytes) - payload,
+            snap.cached_blocks, snap.cached_bytes,
+            snap.free_blocks, snap.free_bytes, snap.largest_free,
+            snap.free_bytes ? 1.0 - (double)snap.largest_free / snap.free_bytes : 0.0,
+            snap.mapped_blocks, snap.mapped_bytes);
+    for (k = 0; k < MM_HEAP_BUCKETS; k++)
+        fprintf(out, ",%zu", snap.free_hist[k]);
+    for (k = 0; k < snap.num_classes; k++)
+        fprintf(out, ",%zu", snap.list_len[k]);
+    fprintf(out, "\n");
+}
+
+/*
+ * merge_timeline - Put the timeline parts of all traces into the -H file,
+ *     in trace order and under one header line. The parts of traces that
+ *     were not valid do not exist.
+ */
+static void merge_timeline(int n)
+{
+    FILE *out, *part;
+    char path[MAXLINE];
+    char line[4 * MAXLINE];
+    int i, first = 1, header;
+
+    if ((out = fopen(timeline_file, "w")) == NULL)
+        unix_error("Could not open the heap timeline in merge_timeline");
+    for (i = 0; i < n; i++) {
+        sprintf(path, "%s.%d", timeline_file, i);
+        if ((part = fopen(path, "r")) == NULL)
+            continue;
+        for (header = 1; fgets(line, sizeof(line), part) != NULL; header = 0)
+            if (!header || first)
+                fputs(line, out);
+        first = 0;
+        fclose(part);
+        unlink(path);
+    }
+    fclose(out);
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size;
+    int i, index, size, n;
     char *p, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
@@ -741,27 +1318,494 @@ static void eval_mm_speed(void *ptr)
 
     /* Interpret each trace request */
     for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+        switch (trace->types[i]) {
 
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = trace->ids[i];
+            size = trace->sizes[i];
             if ((p = mm_malloc(size)) == NULL)
                 app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
 
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            index = trace->ids[i];
+            size = trace->sizes[i];
+            n = batch_len(trace, i);
+            if (mm_malloc_batch(size, (void **)&trace->blocks[index], n) != n)
+                app_error("mm_malloc_batch error in eval_mm_speed");
+            i += n - 1;
+            break;
+
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = trace->ids[i];
             block = trace->blocks[index];
             mm_free(block);
             break;
 
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ids[i];
+            n = batch_len(trace, i);
+            mm_free_batch((void **)&trace->blocks[index], n);
+            i += n - 1;
+            break;
+
         default:
             app_error("Nonexistent request type in eval_mm_valid");
         }
 }
 
+/*
+ * eval_mm_trace - Check one trace for correctness, then measure the space
+ *     utilization and throughput of the mm package on it
+ */
+static void eval_mm_trace(int tracenum, char *tracefile, stats_t *stats, range_t **ranges)
+{
+    trace_t *trace;
+    speed_t speed_params;
+
+    trace = read_trace(tracedir, tracefile);
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+        printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, ranges);
+    if (stats->valid) {
+        if (verbose > 1)
+            printf("efficiency, ");
+        stats->util = eval_mm_util(trace, tracenum, ranges);
+        mm_tcache_stats(&stats->cache_lookups, &stats->cache_hits);
+        stats->heap_peak = mem_heap_peak();
+        stats->heap_end = mem_heapsize();
+        stats->heap_resident = mem_heap_resident();
+        speed_params.trace = trace;
+        speed_params.ranges = *ranges;
+        if (verbose > 1)
+            printf("and performance.\n");
+        stats->secs = fsecs(eval_mm_speed, &speed_params);
+        fsecs_spread(&stats->secs_lo, &stats->secs_hi, &stats->samples);
+        if (latency)
+            eval_mm_latency(trace, stats);
+    }
+    free_trace(trace);
+}
+
+/*
+ * eval_mm_latency - Replay the trace once more, timing every mm call on
+ *     its own, and keep the latency percentiles of each kind of call in
+ *     stats. The cost of reading the clock is measured first and taken
+ *     off every sample.
+ */
+static void eval_mm_latency(trace_t *trace, stats_t *stats)
+{
+    static histogram_t hists[LAT_CALLS][LAT_CLASSES + 1];
+    histogram_t *hist;
+    unsigned long start, ns, overhead = ~0UL;
+    int i, j, c, k, n, index, size;
+    char *p;
+
+    memset(hists, 0, sizeof(hists));
+    for (i = 0; i < 1000; i++) {
+        start = lat_now();
+        ns = lat_now() - start;
+        overhead = (ns < overhead) ? ns : overhead;
+    }
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ids[i];
+        switch (trace->types[i]) {
+
+        case ALLOC: /* mm_malloc */
+            size = trace->sizes[i];
+            start = lat_now();
+            p = mm_malloc(size);
+            ns = lat_now() - start;
+            if (p == NULL)
+                app_error("mm_malloc failed in eval_mm_latency");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            c = 0;
+            n = 1;
+            break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch, counted as n calls of 1/n its time */
+            size = trace->sizes[i];
+            n = batch_len(trace, i);
+            start = lat_now();
+            k = mm_malloc_batch(size, (void **)&trace->blocks[index], n);
+            ns = lat_now() - start;
+            if (k != n)
+                app_error("mm_malloc_batch failed in eval_mm_latency");
+            for (j = 0; j < n; j++)
+                trace->block_sizes[index + j] = size;
+            c = 0;
+            break;
+
+        case FREE: /* mm_free */
+            size = trace->block_sizes[index];
+            p = trace->blocks[index];
+            start = lat_now();
+            mm_free(p);
+            ns = lat_now() - start;
+            c = 1;
+            n = 1;
+            break;
+
+        case FREE_BATCH: /* mm_free_batch, likewise */
+            size = trace->block_sizes[index];
+            n = batch_len(trace, i);
+            start = lat_now();
+            mm_free_batch((void **)&trace->blocks[index], n);
+            ns = lat_now() - start;
+            c = 1;
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_mm_latency");
+            return;
+        }
+        ns = (ns > overhead) ? ns - overhead : 0;
+        for (j = 0; j < n; j++) {
+            hist_add(&hists[c][lat_class(size)], ns / n);
+            hist_add(&hists[c][LAT_CLASSES], ns / n);
+        }
+        i += n - 1;
+    }
+
+    for (c = 0; c < LAT_CALLS; c++) {
+        for (k = 0; k <= LAT_CLASSES; k++) {
+            hist = &hists[c][k];
+            stats->latency[c][k].count = hist->total;
+            stats->latency[c][k].p50 = hist_percentile(hist, 0.5);
+            stats->latency[c][k].p99 = hist_percentile(hist, 0.99);
+            stats->latency[c][k].p999 = hist_percentile(hist, 0.999);
+            stats->latency[c][k].max = hist->max;
+        }
+    }
+}
+
+/* Payload sizes of the latency classes */
+static const int lat_class_max[LAT_CLASSES] = {64, 512, 4096, 128 * 1024, INT_MAX};
+static const char *lat_class_names[LAT_CLASSES] = {"1-64", "65-512", "513-4K", "4K-128K", ">128K"};
+
+static int lat_class(int size)
+{
+    int k = 0;
+
+    while (size > lat_class_max[k])
+        k++;
+    return k;
+}
+
+static unsigned long lat_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void hist_add(histogram_t *hist, unsigned long ns)
+{
+    int e, i;
+
+    if (ns < (1UL << LAT_SUB_BITS)) {
+        i = ns;
+    } else {
+        e = 63 - __builtin_clzl(ns);  /* ns is in [2^e, 2^(e+1)) */
+        i = ((e - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+            (int)((ns >> (e - LAT_SUB_BITS)) - (1UL << LAT_SUB_BITS));
+    }
+    hist->counts[i]++;
+    hist->total++;
+    hist->max = (ns > hist->max) ? ns : hist->max;
+}
+
+/*
+ * hist_percentile - The smallest latency that at least fraction of the
+ *     samples do not exceed, rounded up to the top of its bucket
+ */
+static double hist_percentile(histogram_t *hist, double fraction)
+{
+    size_t seen = 0, want = (size_t)(fraction * hist->total + 0.999999);
+    unsigned long top;
+    int i, e;
+
+    if (hist->total == 0)
+        return 0;
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= want && seen > 0)
+            break;
+    }
+    if (i < (1 << LAT_SUB_BITS)) {
+        top = i;
+    } else {
+        e = (i >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+        top = (((unsigned long)(i & ((1 << LAT_SUB_BITS) - 1)) + (1UL << LAT_SUB_BITS) + 1)
+               << (e - LAT_SUB_BITS)) - 1;
+    }
+    return (top < hist->max) ? top : hist->max;
+}
+
+/*
+ * eval_mm_parallel - Evaluate the traces in jobs forked worker processes.
+ *     Each worker is pinned to a core of its own (as far as there are
+ *     enough), has its own copy of the memlib heap, and takes the next
+ *     trace nobody has started yet from a counter they share. Results
+ *     come back through a pipe, one message per trace; a message is
+ *     smaller than PIPE_BUF, so messages of different workers never mix.
+ *     The traces of a worker that dies are reported as invalid. There
+ *     are never more workers than cores, or they would time each other.
+ */
+static void eval_mm_parallel(int n, char **tracefiles, stats_t *stats, int jobs)
+{
+    int fds[2];
+    int *next_trace;
+    int *done;
+    int w, i, status;
+    pid_t pid;
+    range_t *ranges = NULL;
+    result_msg_t result;
+
+    if (jobs > num_cpus()) {
+        jobs = num_cpus();
+        if (verbose)
+            printf("Using %d worker processes, one per core\n", jobs);
+    }
+    if (jobs > n)
+        jobs = n;
+    next_trace = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (next_trace == MAP_FAILED)
+        unix_error("mmap failed in eval_mm_parallel");
+    *next_trace = 0;
+    if ((done = calloc(n, sizeof(int))) == NULL)
+        unix_error("calloc failed in eval_mm_parallel");
+    if (pipe(fds) < 0)
+        unix_error("pipe failed in eval_mm_parallel");
+    fflush(stdout); /* or the workers print it again */
+
+    for (w = 0; w < jobs; w++) {
+        if ((pid = fork()) < 0)
+            unix_error("fork failed in eval_mm_parallel");
+        if (pid == 0) {
+            close(fds[0]);
+            pin_to_cpu(w);
+            while ((i = __atomic_fetch_add(next_trace, 1, __ATOMIC_RELAXED)) < n) {
+                memset(&result, 0, sizeof(result));
+                result.tracenum = i;
+                result.errors = errors;
+                eval_mm_trace(i, tracefiles[i], &result.stats, &ranges);
+                result.errors = errors - result.errors;
+                fflush(stdout);
+                if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+                    unix_error("write failed in eval_mm_parallel");
+            }
+            exit(0);
+        }
+    }
+
+    close(fds[1]);
+    while (read(fds[0], &result, sizeof(result)) == sizeof(result)) {
+        stats[result.tracenum] = result.stats;
+        errors += result.errors;
+        done[result.tracenum] = 1;
+    }
+    close(fds[0]);
+    for (w = 0; w < jobs; w++)
+        if (wait(&status) < 0)
+            unix_error("wait failed in eval_mm_parallel");
+
+    for (i = 0; i < n; i++) {
+        if (!done[i]) {
+            stats[i].valid = 0;
+            errors++;
+            printf("ERROR [trace %d]: the worker process evaluating it died\n", i);
+        }
+    }
+    free(done);
+    munmap(next_trace, sizeof(int));
+}
+
+/*
+ * num_cpus - The number of cores this process may run on
+ */
+static int num_cpus(void)
+{
+    cpu_set_t allowed;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return 1;
+    return CPU_COUNT(&allowed);
+}
+
+/*
+ * pin_to_cpu - Keep worker w of -j on the w-th core this process may use,
+ *     so its timings do not move between cores half way
+ */
+static void pin_to_cpu(int worker)
+{
+    cpu_set_t allowed, one;
+    int cpu, k = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && k++ == worker) {
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            sched_setaffinity(0, sizeof(one), &one);
+            return;
+        }
+    }
+}
+
+/*
+ * eval_mm_mt - Time num_threads concurrent replays of the trace, one
+ *    mm arena per thread. Returns the running time in seconds.
+ */
+static double eval_mm_mt(trace_t *trace, int num_threads)
+{
+    int i;
+    double secs;
+    mt_speed_t params;
+    pthread_barrier_t done;
+
+    params.num_threads = num_threads;
+    if ((params.threads = calloc(num_threads, sizeof(mt_thread_t))) == NULL)
+        unix_error("calloc failed in eval_mm_mt");
+    pthread_barrier_init(&done, NULL, num_threads);
+
+    for (i = 0; i < num_threads; i++) {
+        mt_thread_t *thread = &params.threads[i];
+        thread->trace = trace;
+        thread->next = &params.threads[(i + 1) % num_threads];
+        thread->done = &done;
+        pthread_mutex_init(&thread->mailbox_lock, NULL);
+        if ((thread->blocks = malloc(trace->num_ids * sizeof(char *))) == NULL ||
+            (thread->mailbox = malloc(trace->num_ops * sizeof(char *))) == NULL)
+            unix_error("malloc failed in eval_mm_mt");
+    }
+
+    set_fsecs_pin(0);   /* the replay threads would inherit the pinning */
+    secs = fsecs(eval_mm_mt_speed, &params);
+    set_fsecs_pin(1);
+
+    for (i = 0; i < num_threads; i++) {
+        pthread_mutex_destroy(&params.threads[i].mailbox_lock);
+        free(params.threads[i].blocks);
+        free(params.threads[i].mailbox);
+    }
+    pthread_barrier_destroy(&done);
+    free(params.threads);
+    return secs;
+}
+
+/*
+ * eval_mm_mt_speed - This is the function that is used by fsecs()
+ *    to measure the running time of concurrent replays of a trace.
+ */
+static void eval_mm_mt_speed(void *ptr)
+{
+    int i;
+    mt_speed_t *params = (mt_speed_t *)ptr;
+    pthread_t tids[MAX_THREADS];
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_mt_speed");
+
+    /* every mailbox is emptied before any thread can hand blocks to it */
+    for (i = 0; i < params->num_threads; i++)
+        params->threads[i].mailbox_count = 0;
+    for (i = 0; i < params->num_threads; i++) {
+        if (pthread_create(&tids[i], NULL, mt_replay, &params->threads[i]) != 0)
+            unix_error("pthread_create failed in eval_mm_mt_speed");
+    }
+    for (i = 0; i < params->num_threads; i++)
+        pthread_join(tids[i], NULL);
+}
+
+/*
+ * mt_replay - Body of one thread of the multi-threaded speed test
+ */
+static void *mt_replay(void *ptr)
+{
+    int i, n, index, frees = 0;
+    char *p;
+    mt_thread_t *thread = (mt_thread_t *)ptr;
+    trace_t *trace = thread->trace;
+
+    if (mm_thread_init() < 0)
+        app_error("mm_thread_init failed in mt_replay");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ids[i];
+        switch (trace->types[i]) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(trace->sizes[i])) == NULL)
+                app_error("mm_malloc error in mt_replay");
+            thread->blocks[index] = p;
+            break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            n = batch_len(trace, i);
+            if (mm_malloc_batch(trace->sizes[i], (void **)&thread->blocks[index], n) != n)
+                app_error("mm_malloc_batch error in mt_replay");
+            i += n - 1;
+            break;
+
+        case FREE_BATCH: /* mm_free_batch, always by the owner */
+            n = batch_len(trace, i);
+            mm_free_batch((void **)&thread->blocks[index], n);
+            i += n - 1;
+            break;
+
+        case FREE: /* mm_free, or hand the block to the next thread */
+            p = thread->blocks[index];
+            if (++frees % REMOTE_EVERY == 0 && thread->next != thread) {
+                pthread_mutex_lock(&thread->next->mailbox_lock);
+                thread->next->mailbox[thread->next->mailbox_count++] = p;
+                pthread_mutex_unlock(&thread->next->mailbox_lock);
+            } else {
+                mm_free(p);
+            }
+            break;
+
+        default:
+            app_error("Nonexistent request type in mt_replay");
+        }
+
+        if (i % DRAIN_EVERY == 0)
+            mt_drain(thread);
+    }
+
+    /* nobody hands over blocks after the barrier, so this drain is the last */
+    pthread_barrier_wait(thread->done);
+    mt_drain(thread);
+    return NULL;
+}
+
+/*
+ * mt_drain - Free every block other threads handed to this thread
+ */
+static void mt_drain(mt_thread_t *thread)
+{
+    int i;
+
+    pthread_mutex_lock(&thread->mailbox_lock);
+    for (i = 0; i < thread->mailbox_count; i++)
+        mm_free(thread->mailbox[i]);
+    thread->mailbox_count = 0;
+    pthread_mutex_unlock(&thread->mailbox_lock);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -774,28 +1818,28 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
     char *p, *newp, *oldp;
 
     for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+        switch (trace->types[i]) {
 
         case ALLOC: /* malloc */
-            if ((p = malloc(trace->ops[i].size)) == NULL) {
+            if ((p = malloc(trace->sizes[i])) == NULL) {
                 malloc_error(tracenum, i, "libc malloc failed");
                 unix_error("System message");
             }
-            trace->blocks[trace->ops[i].index] = p;
+            trace->blocks[trace->ids[i]] = p;
             break;
 
         case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-            oldp = trace->blocks[trace->ops[i].index];
+            newsize = trace->sizes[i];
+            oldp = trace->blocks[trace->ids[i]];
             if ((newp = realloc(oldp, newsize)) == NULL) {
                 malloc_error(tracenum, i, "libc realloc failed");
                 unix_error("System message");
             }
-            trace->blocks[trace->ops[i].index] = newp;
+            trace->blocks[trace->ids[i]] = newp;
             break;
 
         case FREE: /* free */
-            free(trace->blocks[trace->ops[i].index]);
+            free(trace->blocks[trace->ids[i]]);
             break;
 
         default:
@@ -819,18 +1863,18 @@ static void eval_libc_speed(void *ptr)
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+        switch (trace->types[i]) {
         case ALLOC: /* malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = trace->ids[i];
+            size = trace->sizes[i];
             if ((p = malloc(size)) == NULL)
                 unix_error("malloc failed in eval_libc_speed");
             trace->blocks[index] = p;
             break;
 
         case REALLOC: /* realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+            index = trace->ids[i];
+            newsize = trace->sizes[i];
             oldp = trace->blocks[index];
             if ((newp = realloc(oldp, newsize)) == NULL)
                 unix_error("realloc failed in eval_libc_speed\n");
@@ -839,7 +1883,7 @@ static void eval_libc_speed(void *ptr)
             break;
 
         case FREE: /* free */
-            index = trace->ops[i].index;
+            index = trace->ids[i];
             block = trace->blocks[index];
             free(block);
             break;
@@ -863,17 +1907,19 @@ static void printresults(int n, stats_t *stats)
     double util = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n",
-           "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%8s%10s%6s%8s\n",
+           "trace", " valid", "util", "ops", "secs", "Kops", "ci");
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
-            printf("%2d%10s%5.0f%%%8.0f%10.6f%8.0f\n",
+            printf("%2d%10s%5.0f%%%8.0f%10.6f%8.0f%5s%.1f%%\n",
                    i,
                    "yes",
                    stats[i].util*100.0,
                    stats[i].ops,
                    stats[i].secs,
-                   (stats[i].ops/1e3)/stats[i].secs);
+                   (stats[i].ops/1e3)/stats[i].secs,
+                   "+-",
+                   ci_percent(&stats[i]));
             secs += stats[i].secs;
             ops += stats[i].ops;
             util += stats[i].util;
@@ -909,6 +1955,200 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printcacheresults - prints the hit rate of mm's small-block cache per trace
+ *     (prints nothing if the cache is turned off in mm.c)
+ */
+static void printcacheresults(int n, stats_t *stats)
+{
+    int i;
+    size_t lookups = 0;
+    size_t hits = 0;
+
+    for (i=0; i < n; i++)
+        lookups += stats[i].cache_lookups;
+    if (lookups == 0)
+        return;
+
+    printf("Small-block cache hits:\n");
+    printf("%5s%10s%8s%6s\n", "trace", "lookups", "hits", "rate");
+    for (i=0; i < n; i++) {
+        if (stats[i].valid && stats[i].cache_lookups > 0) {
+            printf("%2d%13zu%8zu%5.0f%%\n",
+                   i,
+                   stats[i].cache_lookups,
+                   stats[i].cache_hits,
+                   100.0 * stats[i].cache_hits / stats[i].cache_lookups);
+            hits += stats[i].cache_hits;
+        }
+        else {
+            printf("%2d%13s%8s%6s\n", i, "-", "-", "-");
+        }
+    }
+    printf("%5s%10zu%8zu%5.0f%%\n\n", "Total", lookups, hits, 100.0 * hits / lookups);
+}
+
+/*
+ * printlatencyresults - prints the latency percentiles of mm_malloc and
+ *     mm_free per trace, for all sizes and then for each size class
+ */
+static void printlatencyresults(int n, stats_t *stats)
+{
+    static const char *calls[LAT_CALLS] = {"malloc", "free"};
+    latency_t *lat;
+    int i, c, k;
+
+    printf("Latency of each mm call (ns):\n");
+    printf("%5s%8s%9s%9s%8s%8s%8s%9s\n", "trace", "call", "size", "ops", "p50", "p99", "p99.9", "max");
+    for (i=0; i < n; i++) {
+        if (!stats[i].valid) {
+            printf("%2d%11s%9s%9s%8s%8s%8s%9s\n", i, "-", "-", "-", "-", "-", "-", "-");
+            continue;
+        }
+        for (c = 0; c < LAT_CALLS; c++) {
+            for (k = -1; k < LAT_CLASSES; k++) { /* all sizes first */
+                lat = &stats[i].latency[c][k < 0 ? LAT_CLASSES : k];
+                /* a size class with all the calls would just repeat the "all" row */
+                if (lat->count == 0 || (k >= 0 && lat->count == stats[i].latency[c][LAT_CLASSES].count))
+                    continue;
+                printf("%2d%11s%9s%9zu%8.0f%8.0f%8.0f%9.0f\n",
+                       i, calls[c], k < 0 ? "all" : lat_class_names[k],
+                       lat->count, lat->p50, lat->p99, lat->p999, lat->max);
+            }
+        }
+    }
+    printf("\n");
+}
+
+/*
+ * printheapresults - prints how big the heap got during each trace and how
+ *     much of it mm and memlib had given back by the end of the trace (KB)
+ */
+static void printheapresults(int n, stats_t *stats)
+{
+    int i;
+
+    printf("Heap size at the end of each trace (KB):\n");
+    printf("%5s%8s%8s%10s\n", "trace", "peak", "end", "resident");
+    for (i=0; i < n; i++) {
+        if (stats[i].valid)
+            printf("%2d%11zu%8zu%10zu\n", i, stats[i].heap_peak >> 10,
+                   stats[i].heap_end >> 10, stats[i].heap_resident >> 10);
+        else
+            printf("%2d%11s%8s%10s\n", i, "-", "-", "-");
+    }
+    printf("\n");
+}
+
+/*
+ * saveresults - writes one line of mm stats per trace to filename, so that
+ *     another build of the allocator can be compared with them (-c)
+ */
+static void saveresults(char *filename, int n, char **tracefiles, stats_t *stats)
+{
+    int i;
+    FILE *fp;
+
+    if ((fp = fopen(filename, "w")) == NULL)
+        unix_error("Could not open results file in saveresults");
+    for (i=0; i < n; i++)
+        fprintf(fp, "%s %d %f %f %f\n", tracefiles[i], stats[i].valid,
+                stats[i].util, stats[i].secs, stats[i].ops);
+    fclose(fp);
+}
+
+/*
+ * compareresults - prints the util and throughput of every trace next to the
+ *     ones saved in filename by -s, with the change in utilization
+ */
+static void compareresults(char *filename, int n, char **tracefiles, stats_t *stats)
+{
+    int i, valid;
+    FILE *fp;
+    char name[MAXLINE];
+    double util, secs, ops;
+    double util_sum = 0, base_sum = 0;
+    int compared = 0;
+
+    if ((fp = fopen(filename, "r")) == NULL)
+        unix_error("Could not open results file in compareresults");
+
+    printf("Compared with %s:\n", filename);
+    printf("%5s%7s%7s%8s%8s%8s\n", "trace", "util", "was", "change", "Kops", "was");
+    for (i=0; i < n; i++) {
+        if (fscanf(fp, "%1023s %d %lf %lf %lf", name, &valid, &util, &secs, &ops) != 5)
+            app_error("Results file is shorter than the list of traces");
+        if (strcmp(name, tracefiles[i]))
+            app_error("Results file was saved for other traces");
+        if (!stats[i].valid || !valid) {
+            printf("%2d%10s%7s%8s%8s%8s\n", i, "-", "-", "-", "-", "-");
+            continue;
+        }
+        printf("%2d%9.0f%%%6.0f%%%+7.1f%%%8.0f%8.0f\n",
+               i,
+               stats[i].util*100.0,
+               util*100.0,
+               (stats[i].util - util)*100.0,
+               (stats[i].ops/1e3)/stats[i].secs,
+               (ops/1e3)/secs);
+        util_sum += stats[i].util;
+        base_sum += util;
+        compared++;
+    }
+    if (compared > 0)
+        printf("%5s%6.0f%%%6.0f%%%+7.1f%%\n", "Total",
+               util_sum/compared*100.0, base_sum/compared*100.0,
+               (util_sum - base_sum)/compared*100.0);
+    printf("\n");
+    fclose(fp);
+}
+
+/*
+ * writejson - writes the mm results of every trace to filename as JSON, for
+ *     scripts that watch for regressions: util, the median time and its 95%
+ *     confidence interval, and the throughput with the interval it implies
+ */
+static void writejson(char *filename, int n, char **tracefiles, stats_t *stats,
+                      double perfindex)
+{
+    int i;
+    FILE *fp;
+
+    if ((fp = fopen(filename, "w")) == NULL)
+        unix_error("Could not open JSON file in writejson");
+    fprintf(fp, "{\n  \"timer\": \"%s\",\n  \"traces\": [\n",
+            USE_BENCH ? "median" : USE_FCYC ? "fcyc" : USE_ITIMER ? "itimer" : "gettod");
+    for (i=0; i < n; i++) {
+        fprintf(fp, "    {\"trace\": \"%s\", \"valid\": %s", tracefiles[i],
+                stats[i].valid ? "true" : "false");
+        if (stats[i].valid)
+            fprintf(fp, ", \"util\": %.4f, \"ops\": %.0f, \"samples\": %d, "
+                    "\"secs\": %.9f, \"secs_ci\": [%.9f, %.9f], "
+                    "\"kops\": %.1f, \"kops_ci\": [%.1f, %.1f], \"heap_peak\": %zu",
+                    stats[i].util, stats[i].ops, stats[i].samples,
+                    stats[i].secs, stats[i].secs_lo, stats[i].secs_hi,
+                    (stats[i].ops/1e3)/stats[i].secs,
+                    (stats[i].ops/1e3)/stats[i].secs_hi,
+                    (stats[i].ops/1e3)/stats[i].secs_lo,
+                    stats[i].heap_peak);
+        fprintf(fp, "}%s\n", i < n-1 ? "," : "");
+    }
+    fprintf(fp, "  ],\n  \"errors\": %d,\n  \"perfindex\": %.1f\n}\n", errors, perfindex);
+    fclose(fp);
+}
+
+/*
+ * ci_percent - how far the confidence interval of a trace's time reaches
+ *     from the median, in percent of it
+ */
+static double ci_percent(stats_t *stats)
+{
+    double lo = stats->secs - stats->secs_lo;
+    double hi = stats->secs_hi - stats->secs;
+
+    return 100.0 * (lo > hi ? lo : hi) / stats->secs;
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -941,14 +2181,23 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void)
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvVablL] [-f <file>] [-t <dir>] [-T <n>] [-j <n>] [-H <file> [-i <n>]] [-J <file>] [-s <file>] [-c <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-b         Replay batch requests as single mm_malloc/mm_free calls.\n");
+    fprintf(stderr, "\t-c <file>  Compare per-trace results with <file> from -s.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <file>  Write a CSV timeline of heap snapshots to <file>.\n");
+    fprintf(stderr, "\t-i <n>     Take a heap snapshot for -H every n ops (1000).\n");
+    fprintf(stderr, "\t-J <file>  Write the results with confidence intervals as JSON to <file>.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to n traces at once in processes pinned to cores.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print latency percentiles of every kind of mm call.\n");
+    fprintf(stderr, "\t-s <file>  Save per-trace results to <file>.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Also replay each trace in 1..n threads, one arena each.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
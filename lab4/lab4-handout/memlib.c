@@ -2,7 +2,23 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            The simulated heap is a region with its own brk pointer. Besides
+ *            the default heap behind mem_sbrk, extra regions can be created
+ *            (one per thread arena); each one is only ever grown by its owner,
+ *            so only creating and releasing regions needs a lock.
+ *
+ *            With MEM_OS_BACKED (config.h) a region is address space reserved
+ *            with mmap: pages are only made accessible as brk grows past them,
+ *            brk can move back down, and the pages above a brk that shrank far
+ *            enough are returned to the OS. mem_decommit hands back the pages
+ *            inside a span the caller no longer uses, without unmapping them.
+ *
+ *            mem_map hands out page-granular mappings outside of any region
+ *            (always real mmap'd memory). They count towards the heap size
+ *            that mem_heap_peak reports, and mem_reset_brk unmaps them all.
  */
+#define _GNU_SOURCE     /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,28 +26,46 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
 
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_region_t heap;    /* the default heap used by mem_sbrk */
+static mem_region_t *regions[MAX_REGIONS]; /* extra regions handed out by mem_region_new */
+static int num_regions;
+static pthread_mutex_t regions_lock = PTHREAD_MUTEX_INITIALIZER; 
+
+/* A mapping handed out by mem_map */
+typedef struct mem_mapping {
+    char *start;
+    size_t size;               /* whole pages */
+    struct mem_mapping *next;
+} mem_mapping_t;
+
+static mem_mapping_t *mappings;     /* every live mapping */
+static size_t mapped;               /* bytes in all of them */
+static size_t peak_size;            /* largest heap size plus mapped bytes since the last reset */
+static pthread_mutex_t mappings_lock = PTHREAD_MUTEX_INITIALIZER; 
+
+static int region_reserve(mem_region_t *region, size_t size);
+static void region_unreserve(mem_region_t *region);
+static int region_commit(mem_region_t *region, char *end);
+static void region_trim(mem_region_t *region);
+static void update_peak(void);
+static size_t page_round(size_t size);
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	   fprintf(stderr, "mem_init_vm: malloc error\n");
+    /* reserve the storage we will use to model the available VM */
+    if (region_reserve(&heap, MAX_HEAP) < 0) {
+	   fprintf(stderr, "mem_init_vm: could not reserve the heap\n");
 	   exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
 /* 
@@ -39,33 +73,47 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();
+    region_unreserve(&heap);
 }
 
 /*
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ *    and release every extra region. The pages of the default heap stay
+ *    committed, so replaying a trace again does not fault them back in.
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    heap.brk = heap.start_brk;
+
+    pthread_mutex_lock(&regions_lock);
+    while (num_regions > 0) {
+        mem_region_t *region = regions[--num_regions];
+        region_unreserve(region);
+        free(region);
+    }
+    pthread_mutex_unlock(&regions_lock);
+
+    pthread_mutex_lock(&mappings_lock);
+    while (mappings != NULL) {
+        mem_mapping_t *mapping = mappings;
+        mappings = mapping->next;
+        munmap(mapping->start, mapping->size);
+        free(mapping);
+    }
+    mapped = 0;
+    peak_size = 0;
+    pthread_mutex_unlock(&mappings_lock);
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area.
+ *    A negative incr shrinks the heap and returns the old brk.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
-
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	   errno = ENOMEM;
-	   fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	   return (void *)-1;
-    }
-    mem_brk += incr;
-    return (void *)old_brk;
+    return mem_region_sbrk(&heap, incr);
 }
 
 /*
@@ -73,7 +121,7 @@ void *mem_sbrk(int incr)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return (void *)heap.start_brk;
 }
 
 /* 
@@ -81,7 +129,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return (void *)(heap.brk - 1);
 }
 
 /*
@@ -89,7 +137,79 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return (size_t)(heap.brk - heap.start_brk);
+}
+
+/*
+ * mem_heap_peak() - returns the largest size the heap plus all mappings
+ *    have had since the last mem_reset_brk, in bytes
+ */
+size_t mem_heap_peak() 
+{
+    size_t peak;
+
+    pthread_mutex_lock(&mappings_lock);
+    peak = peak_size;
+    pthread_mutex_unlock(&mappings_lock);
+    return peak;
+}
+
+/*
+ * mem_mapped() - returns how many bytes are mapped by mem_map right now
+ */
+size_t mem_mapped() 
+{
+    size_t bytes;
+
+    pthread_mutex_lock(&mappings_lock);
+    bytes = mapped;
+    pthread_mutex_unlock(&mappings_lock);
+    return bytes;
+}
+
+/*
+ * mem_contains - true if the size bytes at p lie inside the heap (below brk)
+ *    or inside a single mapping from mem_map
+ */
+int mem_contains(void *p, size_t size)
+{
+    char *lo = (char *)p;
+    mem_mapping_t *mapping;
+    int found = 0;
+
+    if (lo >= heap.start_brk && size <= (size_t)(heap.brk - lo))
+        return 1;
+
+    pthread_mutex_lock(&mappings_lock);
+    for (mapping = mappings; mapping != NULL && !found; mapping = mapping->next)
+        found = lo >= mapping->start && size <= (size_t)(mapping->start + mapping->size - lo);
+    pthread_mutex_unlock(&mappings_lock);
+    return found;
+}
+
+/*
+ * mem_heap_resident() - returns how many bytes of the pages below brk are
+ *    backed by physical memory right now (all of them without MEM_OS_BACKED)
+ */
+size_t mem_heap_resident() 
+{
+#if MEM_OS_BACKED
+    size_t pagesize = mem_pagesize();
+    size_t npages = (heap.brk - heap.start_brk + pagesize - 1) / pagesize;
+    size_t i, resident = 0;
+    unsigned char *vec;
+
+    if (npages == 0 || (vec = malloc(npages)) == NULL)
+        return 0;
+    if (mincore(heap.start_brk, npages * pagesize, vec) == 0) {
+        for (i = 0; i < npages; i++)
+            resident += vec[i] & 1;
+    }
+    free(vec);
+    return resident * pagesize;
+#else
+    return mem_heapsize();
+#endif
 }
 
 /*
@@ -99,3 +219,269 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_heap_region - return the default heap as a region, so code written
+ *    against regions can also use the heap behind mem_sbrk
+ */
+mem_region_t *mem_heap_region(void)
+{
+    return &heap;
+}
+
+/*
+ * mem_region_new - create an empty region that can grow to size bytes.
+ *    Safe to call from any thread. Returns NULL if MAX_REGIONS regions
+ *    already exist or the storage can not be allocated.
+ */
+mem_region_t *mem_region_new(size_t size)
+{
+    mem_region_t *region = NULL;
+
+    pthread_mutex_lock(&regions_lock);
+    if (num_regions < MAX_REGIONS && (region = malloc(sizeof(mem_region_t))) != NULL) {
+        if (region_reserve(region, size) < 0) {
+            free(region);
+            region = NULL;
+        } else {
+            regions[num_regions++] = region;
+        }
+    }
+    pthread_mutex_unlock(&regions_lock);
+
+    if (region == NULL)
+        fprintf(stderr, "ERROR: mem_region_new failed. Out of regions or memory...\n");
+    return region;
+}
+
+/*
+ * mem_region_sbrk - mem_sbrk for a single region. Only the owner of a
+ *    region may grow or shrink it, so no locking is needed.
+ */
+void *mem_region_sbrk(mem_region_t *region, int incr)
+{
+    char *old_brk = region->brk;
+
+    if ((incr < 0 && -(long)incr > region->brk - region->start_brk) ||
+        (incr > 0 && incr > region->max_addr - region->brk) ||
+        region_commit(region, region->brk + incr) < 0) {
+	   errno = ENOMEM;
+	   fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	   return (void *)-1;
+    }
+    region->brk += incr;
+    if (incr > 0 && region == &heap)
+        update_peak();
+    if (incr < 0)
+        region_trim(region);
+    return (void *)old_brk;
+}
+
+/*
+ * mem_region_contains - true if p lies inside the storage reserved for region
+ */
+int mem_region_contains(mem_region_t *region, void *p)
+{
+    return (char *)p >= region->start_brk && (char *)p < region->max_addr;
+}
+
+/*
+ * mem_decommit - give the whole pages inside [p, p + len) back to the OS.
+ *    They stay mapped and read as zeros the next time they are touched.
+ *    Returns the number of bytes released (always 0 without MEM_OS_BACKED).
+ */
+size_t mem_decommit(void *p, size_t len)
+{
+#if MEM_OS_BACKED
+    size_t pagesize = mem_pagesize();
+    char *lo = (char *)(((size_t)p + pagesize - 1) & ~(pagesize - 1));
+    char *hi = (char *)(((size_t)p + len) & ~(pagesize - 1));
+
+    if (hi <= lo || madvise(lo, hi - lo, MADV_DONTNEED) < 0)
+        return 0;
+    return hi - lo;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * mem_map - map size bytes (rounded up to whole pages) of fresh zeroed memory
+ *    outside of every region. Safe to call from any thread.
+ *    Returns NULL if the memory can not be mapped.
+ */
+void *mem_map(size_t size)
+{
+    mem_mapping_t *mapping;
+    char *start;
+
+    size = page_round(size);
+    if ((mapping = malloc(sizeof(mem_mapping_t))) == NULL)
+        return NULL;
+    start = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (start == MAP_FAILED) {
+        free(mapping);
+        return NULL;
+    }
+    mapping->start = start;
+    mapping->size = size;
+
+    pthread_mutex_lock(&mappings_lock);
+    mapping->next = mappings;
+    mappings = mapping;
+    mapped += size;
+    pthread_mutex_unlock(&mappings_lock);
+    update_peak();
+    return start;
+}
+
+/*
+ * mem_unmap - give a mapping from mem_map back to the OS; size is the size
+ *    it was mapped (or last remapped) with
+ */
+void mem_unmap(void *p, size_t size)
+{
+    mem_mapping_t **link;
+    mem_mapping_t *mapping = NULL;
+
+    pthread_mutex_lock(&mappings_lock);
+    for (link = &mappings; *link != NULL; link = &(*link)->next) {
+        if ((*link)->start == p) {
+            mapping = *link;
+            *link = mapping->next;
+            mapped -= mapping->size;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mappings_lock);
+
+    munmap(p, page_round(size));
+    free(mapping);
+}
+
+/*
+ * mem_remap - resize a mapping from mem_map to new_size bytes (rounded up
+ *    to whole pages), moving it if it can not grow where it is. Returns the
+ *    new start of the mapping, or NULL (and the mapping is unchanged).
+ */
+void *mem_remap(void *p, size_t old_size, size_t new_size)
+{
+    mem_mapping_t *mapping;
+    char *start;
+
+    old_size = page_round(old_size);
+    new_size = page_round(new_size);
+    if ((start = mremap(p, old_size, new_size, MREMAP_MAYMOVE)) == MAP_FAILED)
+        return NULL;
+
+    pthread_mutex_lock(&mappings_lock);
+    for (mapping = mappings; mapping != NULL; mapping = mapping->next) {
+        if (mapping->start == p) {
+            mapping->start = start;
+            mapping->size = new_size;
+            break;
+        }
+    }
+    mapped += new_size - old_size;
+    pthread_mutex_unlock(&mappings_lock);
+    update_peak();
+    return start;
+}
+
+/*
+ * update_peak - remember the current heap size plus mapped bytes if it is
+ *    the largest so far
+ */
+static void update_peak(void)
+{
+    pthread_mutex_lock(&mappings_lock);
+    if (mem_heapsize() + mapped > peak_size)
+        peak_size = mem_heapsize() + mapped;
+    pthread_mutex_unlock(&mappings_lock);
+}
+
+/*
+ * page_round - size rounded up to whole pages
+ */
+static size_t page_round(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+
+    return (size + pagesize - 1) & ~(pagesize - 1);
+}
+
+/*
+ * region_reserve - set region up as an empty region of size bytes
+ *    Returns 0 on success, -1 if the storage can not be reserved.
+ */
+static int region_reserve(mem_region_t *region, size_t size)
+{
+#if MEM_OS_BACKED
+    region->start_brk = mmap(NULL, size, PROT_NONE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region->start_brk == MAP_FAILED)
+        return -1;
+    region->commit = region->start_brk;          /* nothing is committed yet */
+#else
+    if ((region->start_brk = (char *)malloc(size)) == NULL)
+        return -1;
+    region->commit = region->start_brk + size;   /* all of it is usable */
+#endif
+    region->max_addr = region->start_brk + size; /* max legal heap address */
+    region->brk = region->start_brk;             /* heap is empty initially */
+    return 0;
+}
+
+/*
+ * region_unreserve - give the storage of region back
+ */
+static void region_unreserve(mem_region_t *region)
+{
+#if MEM_OS_BACKED
+    munmap(region->start_brk, region->max_addr - region->start_brk);
+#else
+    free(region->start_brk);
+#endif
+}
+
+/*
+ * region_commit - make sure every byte of region below end is backed by
+ *    memory, committing whole MEM_COMMIT_CHUNKs. Returns -1 on failure.
+ */
+static int region_commit(mem_region_t *region, char *end)
+{
+#if MEM_OS_BACKED
+    size_t size;
+    char *new_commit;
+
+    if (end <= region->commit)
+        return 0;
+    size = end - region->start_brk;
+    size = (size + MEM_COMMIT_CHUNK - 1) / MEM_COMMIT_CHUNK * MEM_COMMIT_CHUNK;
+    new_commit = region->start_brk + size;
+    if (new_commit > region->max_addr)
+        new_commit = region->max_addr;
+    if (mprotect(region->commit, new_commit - region->commit, PROT_READ | PROT_WRITE) < 0)
+        return -1;
+    region->commit = new_commit;
+#endif
+    return 0;
+}
+
+/*
+ * region_trim - once brk is MEM_TRIM_SIZE or more below the committed end,
+ *    return the pages above brk to the OS and make them inaccessible again
+ */
+static void region_trim(mem_region_t *region)
+{
+#if MEM_OS_BACKED
+    size_t pagesize = mem_pagesize();
+    char *end = (char *)(((size_t)region->brk + pagesize - 1) & ~(pagesize - 1));
+
+    if (region->commit - end < MEM_TRIM_SIZE)
+        return;
+    madvise(end, region->commit - end, MADV_DONTNEED);
+    mprotect(end, region->commit - end, PROT_NONE);
+    region->commit = end;
+#endif
+}
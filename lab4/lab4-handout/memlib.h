@@ -1,5 +1,13 @@
 #include <unistd.h>
 
+/* A contiguous simulated heap with its own brk pointer */
+typedef struct {
+    char *start_brk;  /* points to first byte of the region */
+    char *brk;        /* points to last byte of the region, plus one */
+    char *max_addr;   /* largest legal address of the region, plus one */
+    char *commit;     /* end of the pages that are backed by memory */
+} mem_region_t;
+
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(int incr);
@@ -7,5 +15,18 @@ void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_heap_peak(void);
+size_t mem_heap_resident(void);
 size_t mem_pagesize(void);
+size_t mem_decommit(void *p, size_t len);
+size_t mem_mapped(void);
+int mem_contains(void *p, size_t size);
+
+void *mem_map(size_t size);
+void mem_unmap(void *p, size_t size);
+void *mem_remap(void *p, size_t old_size, size_t new_size);
 
+mem_region_t *mem_heap_region(void);
+mem_region_t *mem_region_new(size_t size);
+void *mem_region_sbrk(mem_region_t *region, int incr);
+int mem_region_contains(mem_region_t *region, void *p);
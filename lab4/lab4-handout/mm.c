@@ -3,16 +3,39 @@
  *
  * By Sam Johnson-Lacoss and Lev Shuster (johnsonlacosss shusterl)
  *
- * Simple allocator based on explicit free lists, first fit search,
+ * Simple allocator based on segregated explicit free lists, segregated fit search,
  * and boundary tag coalescing. 
  * Every time the heap is exstended or an item is freed, the allocator attempts to coalsce
+ * Realloc works in place whenever it can: shrinking splits off the tail, and growing
+ * absorbs a free right neighbor and/or extends the heap when the block is at its end
+ *
+ * Free blocks are sorted into NUM_CLASSES size classes. Blocks up to SMALL_LIMIT bytes
+ * get one class per 16 byte step (so every block in the class is the same size), larger
+ * blocks get one class per power of two. A search starts in the class of the request
+ * and only has to walk that one list: the first block of any larger class always fits.
+ *
+ * Best-fit tree (BEST_FIT_TREE): free blocks of TREE_MIN bytes or more are not kept in
+ * lists but in one treap per arena, ordered by (size, address), whose root sits in the 
+ * root slot of TREE_MIN's class. A node's two links are the same two payload words a 
+ * list block uses for next/prev, here its left and right child; the heap priority of a 
+ * node is a hash of its address, so nothing else has to be stored and the tree stays 
+ * balanced in expectation. A search walks down once (O(log n)) to the smallest block
+ * that fits, preferring the lowest address among equal sizes (address-ordered best fit).
  *
  * Each block has header and footer of the form:
  *
  *      63                  4  3  2  1  0
  *      ------------------------------------
- *     | s  s  s  s  ... s  s  0  0  0  a/f |
+ *     | s  s  s  s  ... s  s  0  0  p  a/f |
  *      ------------------------------------
+ *
+ * Footerless layout (FOOTERLESS): only free blocks have a footer. The p bit of a
+ * header is 1 if and only if the block right before it is allocated, which is all 
+ * coalesce needs to know about an allocated left neighbor. That saves a word on 
+ * every allocated block and lets a block be as small as 16 bytes (header plus one 
+ * word of payload). A free block of 16 bytes has no room for list links, so it stays 
+ * off the free lists until a neighbor is freed and coalesces with it.
+ * Without FOOTERLESS, p is always 0 and every block has a footer.
  * 
  * 
  * Each empty block in addition to the above header and footer has a pointer the
@@ -24,19 +47,84 @@
  * where s are the meaningful size bits and a/f is 1
  * if and only if the block is allocated. The list has the following form:
  *
- * begin                                                             end
- * heap                                                             heap
- *  -----------------------------------------------------------------
- * |  pad   | hdr(16:a) | ftr(16:a) | zero or more usr blks | hdr(0:a) |
- *  -----------------------------------------------------------------
- *          |       prologue        |                       | epilogue |
- *          |         block         |                       | block    |
+ * begin                                                                        end
+ * heap                                                                        heap
+ *  ----------------------------------------------------------------------------
+ * | root 0 | ... | root 18 | hdr(16:a) | ftr(16:a) | zero or more usr blks | hdr(0:a) |
+ *  ----------------------------------------------------------------------------
+ *                          |       prologue        |                       | epilogue |
+ *                          |         block         |                       | block    |
  *
  * The allocated prologue and epilogue blocks are overhead that
  * eliminate edge conditions during coalescing.
  *
- * The pad contains all 0s when there are no empty blocks
- * THe pad contains the address of the first empty block otherwise
+ * Each root contains 0 when its size class has no empty blocks
+ * and the address of the first empty block of that class otherwise
+ *
+ * Multi-arena mode: a thread that calls mm_thread_init gets its own arena, a heap
+ * with exactly the layout above in its own memlib region, so threads never share
+ * free lists or boundary tags and need no locks. A block freed by a thread that
+ * does not own it is pushed onto the owner's remote-free stack (linked through the
+ * payload) with a compare-and-swap; the owner frees the whole stack at its next malloc.
+ * Threads that never call mm_thread_init (or whose call failed) share the main arena on
+ * the default heap, which is only used under a lock. When a thread exits, its arena slot
+ * goes on a free list and the next mm_thread_init takes it over, heap included.
+ *
+ * Small-block cache (TCACHE): every arena keeps a short LIFO stack per exact size class
+ * of recently freed blocks of at most SMALL_LIMIT bytes. Cached blocks keep their
+ * allocated header and footer, so free and malloc of a cached size skip place and
+ * coalesce completely. A stack holds at most TCACHE_DEPTH blocks; the rest go to the
+ * free lists as usual, and all stacks are flushed into the free lists when a fit fails.
+ *
+ * Deferred coalescing (DEFERRED_COALESCE): a freed block of at most QUICK_LIMIT bytes that
+ * the small-block cache has no room for is not coalesced either, but pushed on the quick
+ * list of its exact size (one per 16 bytes), still marked allocated. A malloc of exactly
+ * that size pops it back without place or a list search. The quick lists are swept in
+ * one batch, coalescing every block on them, when a fit fails or when they hold more than
+ * QUICK_WATERMARK bytes, so alloc/free churn of the same sizes does not merge blocks only
+ * to split them again, while the heap never holds more than the watermark uncoalesced.
+ *
+ * Batches: mm_malloc_batch carves blocks of one size one after another out of a single
+ * free span, so n blocks cost one fit search and one free list update per span rather
+ * than per block. mm_free_batch sorts its pointers by address and frees every run of
+ * blocks that are neighbors on the heap as one block, coalescing it once per run.
+ *
+ * Aligned blocks: mm_memalign allocates a block with room for a gap in front of the
+ * payload, frees the gap as a block of its own and trims the end, so slabs (slab.c) that
+ * are aligned to their size can be carved back to back.
+ *
+ * Bitmap zone (BITMAP_ZONE): a request of at most ZONE_MAX bytes is served from a zone chunk,
+ * a block of ZONE_CHUNK bytes at a multiple of ZONE_CHUNK (from mm_memalign) that is split
+ * into 16-byte granules with no header at all. Two bitmaps in the chunk header record which
+ * granules are in use and which granule ends a block, so a free clears the bits up to the
+ * next end bit, and a fit search looks for a run of free bits instead of following list
+ * links: the 256 occupancy bits of a chunk are searched with a few SIMD shifts and ANDs
+ * and a tzcnt (see zone_search). A bit per ZONE_CHUNK of the arena's region (the chunk map)
+ * tells mm_free whether a pointer is a zone block. Everything larger keeps the boundary
+ * tags above; a chunk whose granules are all free goes back to the heap, except one spare.
+ *
+ * Handles: a block allocated with mm_halloc is reached through a handle, a slot of a
+ * handle table that holds its payload address. The block has HANDLE_BIT set in its header
+ * and a pointer back to its slot in the first word of its payload (the caller's data
+ * starts DSIZE bytes in). mm_compact walks the heap and slides every handle block down
+ * over the free space before it, updating its slot; blocks allocated with mm_malloc stay
+ * where they are. The free space gathered at the end of the heap is then trimmed, so a
+ * few long-lived handle blocks no longer pin the heap at its peak. Handle slots come in
+ * pages of their own from mem_map and never move.
+ *
+ * Returning memory: when a free leaves a free block of TRIM_THRESHOLD bytes or more at
+ * the end of the heap, the heap is shrunk with a negative sbrk down to CHUNKSIZE bytes
+ * of that block. A free block of DECOMMIT_THRESHOLD bytes or more inside the heap keeps
+ * its place, but the pages between its links and its footer are handed back to the OS
+ * (mem_decommit); they read as zeros when the block is used again.
+ *
+ * Large blocks: a request of MMAP_THRESHOLD bytes or more does not touch the heap at all.
+ * It gets its own pages from mem_map, without a header, and is recorded in the direct 
+ * table, a hash table (open addressing, linear probing) from payload address to mapping
+ * size that lives in pages of its own and is shared by all arenas under one lock. 
+ * mm_free unmaps such a block right away, and mm_realloc resizes it with mem_remap. 
+ * Only pointers that no arena's region holds are looked up in the table, so handing a
+ * block back to another arena never waits for the table's lock.
  */
 
 
@@ -46,6 +134,11 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
@@ -55,7 +148,63 @@
 #define DSIZE               16      /* doubleword size (bytes) */
 #define CHUNKSIZE           (1<<12) /* initial heap size (bytes) */
 #define OVERHEAD            16      /* overhead of header and footer (bytes) */
-#define MIN_B_SIZE          32      /* min block size */
+#ifndef FOOTERLESS
+#define FOOTERLESS          1       /* set to 0 to give allocated blocks a footer too */
+#endif
+#if FOOTERLESS
+#define ALLOC_OVERHEAD      WSIZE   /* overhead of an allocated block: header only (bytes) */
+#define MIN_B_SIZE          16      /* min block size */
+#define PREV_ALLOC_BIT      0x2     /* header bit set when the previous block is allocated */
+#else
+#define ALLOC_OVERHEAD      OVERHEAD
+#define MIN_B_SIZE          32
+#define PREV_ALLOC_BIT      0
+#endif
+#define MIN_LIST_SIZE       32      /* min size of a block on a free list: header, 2 links, footer */
+#define REALLOC_SLACK       8       /* a resized block keeps up to 1/REALLOC_SLACK of its size as room to grow */
+#define HANDLE_BIT          0x4     /* header bit of a block owned by a handle (mm_halloc) */
+#define HANDLE_CHUNK        512     /* handle slots mapped at a time */
+#ifndef BEST_FIT_TREE
+#define BEST_FIT_TREE       1       /* set to 0 to keep large free blocks in first-fit lists too */
+#endif
+#define TREE_MIN            512     /* smallest free block kept in the best-fit tree (a power of two) */
+#define NUM_CLASSES         19      /* number of segregated free lists (odd to keep the prologue aligned) */
+#define SMALL_LIMIT         128     /* largest block size that gets an exact size class */
+#ifndef TCACHE
+#define TCACHE              1       /* set to 0 to turn off the small-block cache */
+#endif
+#define TCACHE_DEPTH        8       /* max number of blocks cached per size class */
+#define TCACHE_CLASSES      ((SMALL_LIMIT - MIN_LIST_SIZE) / DSIZE + 1) /* the exact size classes */
+#ifndef DEFERRED_COALESCE
+#define DEFERRED_COALESCE   0       /* set to 1 to keep freed blocks on quick lists until a sweep */
+#endif
+#define QUICK_LIMIT         1024    /* largest block size that goes on a quick list */
+#define QUICK_CLASSES       (QUICK_LIMIT / DSIZE + 1) /* one quick list per 16 bytes */
+#define QUICK_WATERMARK     (64*(1<<10)) /* bytes on the quick lists that force a sweep */
+#ifndef BITMAP_ZONE
+#define BITMAP_ZONE         0       /* set to 1 to serve small requests from bitmap-managed zone chunks */
+#endif
+#define ZONE_CHUNK          4096    /* bytes per zone chunk, which is also its alignment */
+#define ZONE_BYTES          (ZONE_CHUNK - DSIZE) /* block size asked of mm_memalign, leaving room for the next header */
+#define ZONE_MAX            256     /* largest request served from the zone (16 granules) */
+#define ZONE_WORDS          4       /* occupancy bitmap words of a chunk: 256 bits, one SIMD vector */
+#define ZONE_MAP_WORDS      (ARENA_SIZE / ZONE_CHUNK / 64 + 1) /* words of an arena's chunk map */
+#define MAX_ARENAS          16      /* max number of per-thread arenas */
+#define ARENA_SIZE          (20*(1<<20)) /* max size of a per-thread arena (bytes) */
+#define TRIM_THRESHOLD      (128*(1<<10)) /* free block at the end of the heap that gets trimmed (bytes) */
+#define DECOMMIT_THRESHOLD  (256*(1<<10)) /* free block inside the heap whose pages are released (bytes) */
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD      (128*(1<<10)) /* smallest request that gets pages of its own, 0 for none (bytes) */
+#endif
+#define DIRECT_MIN_SLOTS    256     /* initial number of slots in the direct table */
+#define DIRECT_DELETED      ((void *) 1) /* start of a slot whose block was freed */
+
+/* Is a request of size bytes a large block? */
+#if MMAP_THRESHOLD
+#define IS_LARGE(size)      ((size) >= MMAP_THRESHOLD)
+#else
+#define IS_LARGE(size)      false
+#endif
 
 
 /* Pack a size and allocated bit into a word */
@@ -72,15 +221,24 @@
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p)  (GET(p) & ~0xf)
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_PREV_ALLOC_BIT(p) (GET(p) & PREV_ALLOC_BIT)
 
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)       (PSUB(bp, WSIZE))
 #define FTRP(bp)       (PADD(bp, GET_SIZE(HDRP(bp)) - DSIZE))
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks 
+ * (PREV_BLKP reads the previous block's footer, so it only works if PREV_ALLOC is false) */
 #define NEXT_BLKP(bp)  (PADD(bp, GET_SIZE(HDRP(bp))))
 #define PREV_BLKP(bp)  (PSUB(bp, GET_SIZE((PSUB(bp, DSIZE)))))
 
+/* Given block ptr bp, is the block right before it allocated? */
+#if FOOTERLESS
+#define PREV_ALLOC(bp) (GET_PREV_ALLOC_BIT(HDRP(bp)))
+#else
+#define PREV_ALLOC(bp) (GET_ALLOC(PSUB(bp, DSIZE)))
+#endif
+
 
 
 /* macros for explicit linked lists */
@@ -93,10 +251,79 @@
 #define LL_PREV(bp) (*PTR_PREV(bp)) // Returns the pointer to the previous bp
 #define LL_NEXT(bp) (*PTR_NEXT(bp)) // Returns the pointer to the next bp
 
-
+/* macros for the best-fit tree, whose nodes reuse the two link words */
+#define IN_TREE(size)   (BEST_FIT_TREE && (size) >= TREE_MIN)   // is a free block of this size in the tree?
+#define TREE_ROOT()     (SEG_ROOT(size_class(TREE_MIN)))        // the slot holding the tree root
+#define PTR_LEFT(bp)    PTR_NEXT(bp)                            // the slot holding bp's left child
+#define PTR_RIGHT(bp)   PTR_PREV(bp)                            // the slot holding bp's right child
+#define TREE_PRIO(bp)   (((size_t) (bp) * 0x9E3779B97F4A7C15UL) >> 32) // treap priority of bp
+
+/* Does block a come before block b in the tree order (size, then address)? */
+#define TREE_LESS(a, b) (GET_SIZE(HDRP(a)) < GET_SIZE(HDRP(b)) || \
+                         (GET_SIZE(HDRP(a)) == GET_SIZE(HDRP(b)) && (size_t) (a) < (size_t) (b)))
+
+// Returns the pointer to the root of the free list for size class i (stored in front of the prologue)
+#define SEG_ROOT(i) ((size_t *) PSUB(arena->heap_start, (NUM_CLASSES + 1 - (i)) * WSIZE))
+
+
+
+/* A heap with its own free lists, owned by one thread */
+typedef struct {
+    void *heap_start;       // Pointer to first block
+    mem_region_t *region;   // memlib region the heap lives in
+    void *remote_frees;     // stack of blocks freed by other threads, linked through the payload
+    void *tcache[TCACHE_CLASSES];       // stacks of cached small blocks, linked through the payload
+    int tcache_count[TCACHE_CLASSES];   // number of blocks in each stack
+    size_t tcache_lookups;              // small mallocs that looked in the cache
+    size_t tcache_hits;                 // ... and found a block there
+    void **free_handles;                // unused handle slots, each holding the next one
+#if DEFERRED_COALESCE
+    void *quick[QUICK_CLASSES];         // quick lists of uncoalesced blocks, by size / DSIZE
+    size_t quick_bytes;                 // total size of the blocks on them
+#endif
+#if BITMAP_ZONE
+    struct zone_chunk *zone_chunks;     // zone chunks with free granules
+    struct zone_chunk *zone_spare;      // at most one zone chunk without used granules, on no list
+    uint64_t zone_map[ZONE_MAP_WORDS];  // bit i set if the i-th ZONE_CHUNK of the region is a zone chunk
+#endif
+} arena_t;
+
+/* The header at the start of every zone chunk, followed by ZONE_GRANULES granules */
+typedef struct zone_chunk {
+    struct zone_chunk *next;    // neighbors on the arena's list of chunks with free granules
+    struct zone_chunk *prev;
+    unsigned int nfree;         // free granules
+    uint64_t used[ZONE_WORDS];  // bit i set if granule i is allocated (or past the last granule)
+    uint64_t ends[ZONE_WORDS];  // bit i set if granule i is the last one of an allocated block
+} zone_chunk_t;
+
+#define ZONE_DATA      ((sizeof(zone_chunk_t) + DSIZE - 1) / DSIZE * DSIZE) // offset of granule 0
+#define ZONE_GRANULES  ((ZONE_BYTES - ZONE_DATA) / DSIZE)                   // granules of a chunk
+
+/* A large block with pages of its own: one slot of the direct table */
+typedef struct {
+    void *start;            // payload of the block and start of its mapping, NULL for an empty slot
+    size_t size;            // size of the mapping (whole pages)
+} direct_t;
 
 /* Global variables */
-static void *heap_start = NULL; // Pointer to first block
+static arena_t main_arena;                          // arena of every thread without an arena of its own
+static pthread_mutex_t main_lock = PTHREAD_MUTEX_INITIALIZER; // taken around every use of the main arena
+static __thread int main_depth = 0;                 // how many calls of this thread hold main_lock (realloc calls malloc)
+static arena_t arenas[MAX_ARENAS];                  // per-thread arenas
+static int num_arenas = 0;                          // number of slots in arenas set up so far (0 means single arena mode)
+static int free_slots[MAX_ARENAS];                  // slots whose thread exited, ready for the next mm_thread_init
+static int num_free_slots = 0;
+static unsigned int arenas_epoch = 0;               // bumped by mm_init, so exits of threads from before do not count
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER; // guards the slot counters and free_slots
+static pthread_key_t arena_key;                     // its destructor gives the slot of an exiting thread back
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+static __thread arena_t *arena = &main_arena;       // arena of the calling thread
+static __thread unsigned int arena_epoch;           // arenas_epoch when the calling thread took its slot
+static direct_t *direct_table = NULL;               // the direct table, or NULL before the first large block
+static size_t direct_slots = 0;                     // number of slots in it (a power of two)
+static size_t direct_used = 0;                      // slots that are not empty (live or deleted)
+static pthread_mutex_t direct_lock = PTHREAD_MUTEX_INITIALIZER; // protects the direct table
 
 /* Function prototypes for internal helper routines */
 static bool check_heap(int lineno);
@@ -105,12 +332,70 @@ static void print_linked_list();
 static void print_block(void *bp);
 static void ll_add(void* bp);
 static void ll_remove(void* bp);
+static void tree_add(void *bp);
+static void tree_remove(void *bp);
+static void *tree_fit(size_t asize);
+static bool check_tree(int lineno, void *bp, void *lo, void *hi);
+static size_t tree_count(void *bp);
+static int size_class(size_t size);
 static bool check_block(int lineno, void *bp);
 static void *extend_heap(size_t size);
+static int arena_init(arena_t *new_arena, mem_region_t *region);
+static arena_t *arena_of(void *bp);
+static arena_t *heap_of(void *bp);
+static void arena_key_create(void);
+static void arena_release(void *slot_arena);
+static void arena_lock(void);
+static void arena_unlock(void);
+static void *arena_malloc(size_t size);
+static void *arena_memalign(size_t align, size_t size);
+static void arena_free(void *bp);
+static int arena_malloc_batch(size_t size, void **ptrs, int n);
+static void arena_free_batch(void **ptrs, int n);
+static void **arena_halloc(size_t size);
+static void arena_hfree(void **handle);
+static size_t arena_compact(void);
+static void arena_heap_snapshot(mm_heap_t *snap);
+static void *arena_realloc(void *ptr, size_t size);
+static void free_remote(void);
+static void free_block(void *bp);
+static void tcache_flush(void);
+static void quick_sweep(void);
 static void *find_fit(size_t asize);
+static void *alloc_block(size_t asize);
+static int carve(void *bp, size_t asize, void **ptrs, int n);
+static int handle_grow(void);
+static void compact_gap(char *lo, char *hi);
+static bool zone_contains(arena_t *owner, void *bp);
+#if BITMAP_ZONE
+static void *zone_alloc(size_t n);
+static void zone_free(void *bp);
+static size_t zone_size(void *bp);
+static void *zone_take(zone_chunk_t *chunk, size_t n);
+static int zone_search(const uint64_t *used, size_t n);
+static zone_chunk_t *zone_new(void);
+static void zone_push(zone_chunk_t *chunk);
+static void zone_unlink(zone_chunk_t *chunk);
+#endif
+static int ptr_cmp(const void *a, const void *b);
 static void *coalesce(void *bp);
 static void place(void *bp, size_t asize);
+static void split_tail(void *bp, size_t asize);
+static void *coalesce_release(void *bp);
+static void release_pages(void *bp, void *lo, void *hi);
+static void *direct_alloc(size_t size);
+static size_t direct_size(void *bp);
+static bool direct_free(void *bp);
+static void *direct_realloc(void *bp, size_t oldsize, size_t size);
+static direct_t *direct_find(void *bp);
+static int direct_reserve(void);
+static void direct_put(void *start, size_t size);
+static void set_alloc(void *bp, size_t size);
+static void set_free(void *bp, size_t size);
+static size_t adjust_size(size_t size);
+static size_t realloc_keep(size_t asize, size_t bsize);
 static size_t max(size_t x, size_t y);
+static size_t min(size_t x, size_t y);
 
 /*
  * For Grading Purposes: Information on the two authors
@@ -129,99 +414,1272 @@ team_t johnsonlacosssshusterl = {
  * the function takes no arguments
  * the function returns 0 if sucsessful and -1 if it was unable to exstend the heap
  * This function takes no arguments nor preconditions
+ * Any per-thread arenas and large blocks from before are forgotten (memlib releases their 
+ * regions and mappings, the direct table included, on reset)
  */
 int mm_init(void) {
+    pthread_mutex_lock(&arenas_lock);
+    num_arenas = 0;
+    num_free_slots = 0;
+    arenas_epoch++;
+    for (int i = 0; i < MAX_ARENAS; i++) {
+        arenas[i].region = NULL;
+    }
+    pthread_mutex_unlock(&arenas_lock);
+    direct_table = NULL;
+    direct_slots = 0;
+    direct_used = 0;
+
+    arena = &main_arena;
+    return arena_init(&main_arena, mem_heap_region());
+}
+
+/*
+ * mm_thread_init -- give the calling thread an arena of its own: the arena of a thread
+ * that exited (with whatever blocks of it are still allocated), or else a new one in a
+ * fresh memlib region. After this call every malloc of the thread is served from that
+ * arena, until the thread exits and its slot is given back (see arena_release).
+ * returns 0 if sucsessful and -1 if all arenas are taken or the region could not be made;
+ * the thread then keeps using the main arena, under its lock like any thread without one
+ * PRECONDITION: mm_init was called (by any thread) since the last memlib reset
+ */
+int mm_thread_init(void) {
+    mem_region_t *region;
+    int slot;
+
+    if (arena != &main_arena) {
+        return 0;
+    }
+    pthread_once(&arena_key_once, arena_key_create);
+
+    pthread_mutex_lock(&arenas_lock);
+    if (num_free_slots > 0) {
+        slot = free_slots[--num_free_slots];
+        arena = &arenas[slot];
+    } else {
+        if (num_arenas >= MAX_ARENAS || (region = mem_region_new(ARENA_SIZE)) == NULL) {
+            pthread_mutex_unlock(&arenas_lock);
+            return -1;
+        }
+        slot = num_arenas;
+        if (arena_init(&arenas[slot], region) < 0) {
+            arena = &main_arena;
+            pthread_mutex_unlock(&arenas_lock);
+            return -1;
+        }
+        /* publish the region first: arena_of only looks at slots below num_arenas */
+        __atomic_store_n(&arenas[slot].region, region, __ATOMIC_RELEASE);
+        __atomic_store_n(&num_arenas, slot + 1, __ATOMIC_RELEASE);
+    }
+    arena_epoch = arenas_epoch;
+    pthread_mutex_unlock(&arenas_lock);
+
+    pthread_setspecific(arena_key, arena);
+    return 0;
+}
+
+/*
+ * The public entry points below run the routine of the same name on the calling thread's
+ * arena. The main arena is shared by every thread without an arena of its own, so it is
+ * only used under main_lock; main_depth lets a routine call another one (realloc calls
+ * malloc and free) without locking twice.
+ */
+void *mm_malloc(size_t size) {
+    void *bp;
+
+    arena_lock();
+    bp = arena_malloc(size);
+    arena_unlock();
+    return bp;
+}
+
+void *mm_memalign(size_t align, size_t size) {
+    void *bp;
+
+    arena_lock();
+    bp = arena_memalign(align, size);
+    arena_unlock();
+    return bp;
+}
+
+void mm_free(void *bp) {
+    arena_lock();
+    arena_free(bp);
+    arena_unlock();
+}
+
+void *mm_realloc(void *ptr, size_t size) {
+    arena_lock();
+    ptr = arena_realloc(ptr, size);
+    arena_unlock();
+    return ptr;
+}
+
+int mm_malloc_batch(size_t size, void **ptrs, int n) {
+    arena_lock();
+    n = arena_malloc_batch(size, ptrs, n);
+    arena_unlock();
+    return n;
+}
+
+void mm_free_batch(void **ptrs, int n) {
+    arena_lock();
+    arena_free_batch(ptrs, n);
+    arena_unlock();
+}
+
+void **mm_halloc(size_t size) {
+    void **handle;
+
+    arena_lock();
+    handle = arena_halloc(size);
+    arena_unlock();
+    return handle;
+}
+
+void mm_hfree(void **handle) {
+    arena_lock();
+    arena_hfree(handle);
+    arena_unlock();
+}
+
+size_t mm_compact(void) {
+    size_t shrunk;
+
+    arena_lock();
+    shrunk = arena_compact();
+    arena_unlock();
+    return shrunk;
+}
+
+void mm_heap_snapshot(mm_heap_t *snap) {
+    arena_lock();
+    arena_heap_snapshot(snap);
+    arena_unlock();
+}
+
+
+/*
+ * arena_malloc -- allocates a 16-byte aligned chunk of memory that correcponds to the size argument
+ * this function takes a 'size' argument, which is the size of the block to allocate
+ * This function returns a void*, which is the pointer to the payload of the now allocated chunk of memory
+ * mm_malloc does not have preconditions/postconditions besides relying on the place function
+ */
+static void *arena_malloc(size_t size) {
+    size_t asize;      /* adjusted block size */
+#if TCACHE || DEFERRED_COALESCE || BITMAP_ZONE
+    char *bp;          /* address of the block that will be returned */
+#endif
+
+    /* Ignore spurious requests */
+    if (size <= 0){ 
+        return NULL;
+    }
+    /* Large blocks get pages of their own */
+    if (IS_LARGE(size)) {
+        return direct_alloc(size);
+    }
+
+    /* Blocks other threads gave back to this arena become available first */
+    if (__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED) != NULL) {
+        free_remote();
+    }
+
+#if BITMAP_ZONE
+    /* Small requests take whole granules of a zone chunk, without a header */
+    if (size <= ZONE_MAX && (bp = zone_alloc((size + DSIZE - 1) / DSIZE)) != NULL) {
+        return bp;
+    }
+#endif
+
+    /* Adjust block size to include overhead and alignment reqs. */
+    asize = adjust_size(size);
+
+#if TCACHE
+    /* A cached block of the same class is still marked allocated, so it is returned as is */
+    if (asize <= SMALL_LIMIT) {
+        int class = size_class(asize);
+
+        arena->tcache_lookups++;
+        if ((bp = arena->tcache[class]) != NULL) {
+            arena->tcache[class] = (void *) GET(bp);
+            arena->tcache_count[class]--;
+            arena->tcache_hits++;
+            return bp;
+        }
+    }
+#endif
+
+#if DEFERRED_COALESCE
+    /* A block on the quick list of this exact size is still marked allocated too */
+    if (asize <= QUICK_LIMIT && (bp = arena->quick[asize / DSIZE]) != NULL) {
+        arena->quick[asize / DSIZE] = (void *) GET(bp);
+        arena->quick_bytes -= asize;
+        return bp;
+    }
+#endif
+
+    return alloc_block(asize);
+}
+
+/*
+ * alloc_block -- the part of mm_malloc after the caches: allocates a block of asize bytes
+ * from the free lists, or from the heap grown by at least CHUNKSIZE bytes if none fits
+ * Returns the block, or NULL if the heap cannot grow
+ */
+static void *alloc_block(size_t asize) {
+    size_t extendsize; /* amount to extend heap if no fit */
+    char *bp;          /* address of the block that will be returned */
+
+    /* Search the free list for a fit */
+    if ((bp = find_fit(asize)) != NULL) {
+        place(bp, asize);
+        return bp;
+    }
+
+#if TCACHE || DEFERRED_COALESCE
+    /* Give the cached and deferred blocks a chance to coalesce into a fit before growing the heap */
+    tcache_flush();
+    quick_sweep();
+    if ((bp = find_fit(asize)) != NULL) {
+        place(bp, asize);
+        return bp;
+    }
+#endif
+
+    /* No fit found. Get more memory and place the block; a free block at the end of the heap
+     * coalesces with the new memory, so the heap only has to grow by what it lacks. A block of
+     * a chunk or more gets exactly that, so it ends the heap and can grow in place later */
+    extendsize = asize;
+    if (!PREV_ALLOC(arena->region->brk)) {
+        extendsize -= min(GET_SIZE(PSUB(arena->region->brk, DSIZE)), asize - MIN_B_SIZE);
+    }
+    if (asize < CHUNKSIZE) {
+        extendsize = max(extendsize, CHUNKSIZE);
+    }
+    if ((bp = extend_heap(extendsize / WSIZE)) == NULL){
+        return NULL;
+    }
+
+    place(bp, asize);
+    return bp;
+}
+
+/*
+ * arena_memalign -- allocates size bytes whose payload starts at a multiple of align bytes
+ * (a power of two). A block with room for an aligned payload after a gap that can be a
+ * free block of its own is allocated; the gap in front of the payload and what the payload
+ * does not need at the end are split off and freed again.
+ * Large blocks with pages of their own are already aligned to up to a page.
+ * Returns the payload, or NULL
+ */
+static void *arena_memalign(size_t align, size_t size) {
+    char *bp;       /* the block allocated with room for the gap */
+    char *p;        /* the aligned payload inside it */
+    size_t bsize;
+
+    if (align <= DSIZE) {
+        return mm_malloc(size);
+    }
+    if (size <= 0) {
+        return NULL;
+    }
+    if (IS_LARGE(size) && align <= mem_pagesize()) {
+        return direct_alloc(size);
+    }
+
+    if (__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED) != NULL) {
+        free_remote();
+    }
+
+    if ((bp = alloc_block(adjust_size(size) + align + MIN_LIST_SIZE)) == NULL) {
+        return NULL;
+    }
+
+    if ((size_t) bp % align != 0) {
+        /* the gap is at least MIN_LIST_SIZE bytes, so it can go on a free list */
+        p = (char *) (((size_t) bp + MIN_LIST_SIZE + align - 1) & ~(align - 1));
+        bsize = GET_SIZE(HDRP(bp));
+
+        PUT(HDRP(p), PACK(0, 0));           // the left neighbor of p is the gap, which is free
+        set_alloc(p, bsize - (p - bp));
+        set_free(bp, p - bp);
+        coalesce_release(bp);
+        bp = p;
+    }
+
+    split_tail(bp, adjust_size(size));
+    return bp;
+}
+
+/*
+ * arena_free -- free the block whose payload is pointed to by the given argument (bp)
+ * the function takes in a pointer to the block that will be freed
+ * This fuction doesn't return anything
+ * This function assumes the payload was provided my mm_malloc and has not already been freed 
+ * PRECONDITION: The payload was returned by an earlier call to mm_malloc
+ * PRECONDITION: The payload has not been previously freed since its most recent return
+ * from malloc 
+ * In multi-arena mode a block owned by another thread's arena is handed back to that arena
+ * A large block with its own pages is unmapped
+ */
+static void arena_free(void *bp) {
+    arena_t *owner;
+
+    /* the regions first: a block of another arena goes back without taking direct_lock */
+    if ((owner = heap_of(bp)) == NULL) {
+        if (MMAP_THRESHOLD && direct_free(bp)) {
+            return;
+        }
+        owner = arena;
+    }
+
+    if (owner != arena) {
+        /* push onto the owner's remote-free stack; only the owner ever pops (all of) it */
+        void *head = __atomic_load_n(&owner->remote_frees, __ATOMIC_RELAXED);
+        do {
+            PUT(bp, (size_t) head);
+        } while (!__atomic_compare_exchange_n(&owner->remote_frees, &head, bp, true,
+                                              __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        return;
+    }
+
+    free_block(bp);
+}
+
+/*
+ * free_block -- mm_free for a block of the calling thread's own arena
+ * PRECONDITION: bp is an allocated block of the calling thread's arena
+ */
+static void free_block(void *bp) {
+#if BITMAP_ZONE
+    if (zone_contains(arena, bp)) {
+        zone_free(bp);
+        return;
+    }
+#endif
+
+#if TCACHE
+    /* Small blocks go on the cache stack of their class while it has room, untouched */
+    size_t size = GET_SIZE(HDRP(bp));
+    if (size <= SMALL_LIMIT && size >= MIN_LIST_SIZE) {
+        int class = size_class(size);
+
+        if (arena->tcache_count[class] < TCACHE_DEPTH) {
+            PUT(bp, (size_t) arena->tcache[class]);
+            arena->tcache[class] = bp;
+            arena->tcache_count[class]++;
+            return;
+        }
+    }
+#endif
+
+#if DEFERRED_COALESCE
+    /* Other blocks up to QUICK_LIMIT wait on a quick list for the next sweep, untouched */
+    size_t qsize = GET_SIZE(HDRP(bp));
+    if (qsize <= QUICK_LIMIT) {
+        PUT(bp, (size_t) arena->quick[qsize / DSIZE]);
+        arena->quick[qsize / DSIZE] = bp;
+        arena->quick_bytes += qsize;
+        if (arena->quick_bytes > QUICK_WATERMARK) {
+            quick_sweep();
+        }
+        return;
+    }
+#endif
+
+    //Update the header and footer
+    set_free(bp, GET_SIZE(HDRP(bp)));
+
+    coalesce_release(bp);   //merge with free neighbors, add to a free list, give back pages
+}
+
+/*
+ * arena_malloc_batch -- allocates n blocks of size bytes each and stores their payloads in ptrs
+ * blocks in the small-block cache (and on the quick list of this size) are handed out first,
+ * the rest are carved one after another out of a free span big enough for all of them, or
+ * failing that out of any block that fits at least one, before the heap is extended
+ * Returns the number of blocks allocated, which is less than n only if memory ran out
+ */
+static int arena_malloc_batch(size_t size, void **ptrs, int n) {
+    size_t asize;   /* adjusted block size */
+    char *bp;       /* the span the next blocks are carved from */
+    int i = 0;      /* number of blocks allocated so far */
+
+    if (size <= 0) {
+        return 0;
+    }
+    /* Large blocks get pages of their own, one at a time */
+    if (IS_LARGE(size)) {
+        for (; i < n && (ptrs[i] = direct_alloc(size)) != NULL; i++);
+        return i;
+    }
+
+    if (__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED) != NULL) {
+        free_remote();
+    }
+
+    asize = adjust_size(size);
+
+#if TCACHE
+    /* counted like n mallocs of size, so the hit rate covers batches too */
+    if (asize <= SMALL_LIMIT) {
+        int class = size_class(asize);
+
+        arena->tcache_lookups += n;
+        for (; i < n && (bp = arena->tcache[class]) != NULL; i++) {
+            arena->tcache[class] = (void *) GET(bp);
+            arena->tcache_count[class]--;
+            ptrs[i] = bp;
+        }
+        arena->tcache_hits += i;
+    }
+#endif
+#if DEFERRED_COALESCE
+    if (asize <= QUICK_LIMIT) {
+        for (; i < n && (bp = arena->quick[asize / DSIZE]) != NULL; i++) {
+            arena->quick[asize / DSIZE] = (void *) GET(bp);
+            arena->quick_bytes -= asize;
+            ptrs[i] = bp;
+        }
+    }
+#endif
+
+    while (i < n) {
+        if ((bp = find_fit(asize * (n - i))) == NULL && (bp = find_fit(asize)) == NULL) {
+#if TCACHE || DEFERRED_COALESCE
+            tcache_flush();
+            quick_sweep();
+            bp = find_fit(asize);
+#endif
+            if (bp == NULL && (bp = extend_heap(max(asize * (n - i), CHUNKSIZE) / WSIZE)) == NULL) {
+                break;
+            }
+        }
+        i += carve(bp, asize, ptrs + i, n - i);
+    }
+    return i;
+}
+
+/*
+ * arena_free_batch -- frees the n blocks whose payloads are in ptrs; NULL entries are skipped
+ * ptrs is sorted by address (so its order is lost), and every run of blocks that follow
+ * each other on the heap is freed as one block, with a single coalesce for the run
+ * batch frees do not go through the small-block cache or the quick lists
+ * PRECONDITION: every payload was returned by mm_malloc and has not been freed since
+ */
+static void arena_free_batch(void **ptrs, int n) {
+    void *bp;
+    size_t size;
+
+    if (__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED) != NULL) {
+        free_remote();
+    }
+
+    /* batches carved by mm_malloc_batch usually come back in address order already */
+    for (int i = 1; i < n; i++) {
+        if ((size_t) ptrs[i - 1] > (size_t) ptrs[i]) {
+            qsort(ptrs, n, sizeof(void *), ptr_cmp);
+            break;
+        }
+    }
+    for (int i = 0; i < n; ) {
+        if ((bp = ptrs[i++]) == NULL) {
+            continue;
+        }
+        /* large blocks, zone blocks and blocks of other arenas take the usual way */
+        if (!mem_region_contains(arena->region, bp) || zone_contains(arena, bp) ||
+            (__atomic_load_n(&num_arenas, __ATOMIC_RELAXED) > 0 && arena_of(bp) != arena)) {
+            mm_free(bp);
+            continue;
+        }
+
+        size = GET_SIZE(HDRP(bp));
+        while (i < n && ptrs[i] == PADD(bp, size)) {
+            size += GET_SIZE(HDRP(ptrs[i++]));
+        }
+        set_free(bp, size);
+        coalesce_release(bp);
+    }
+}
+
+/*
+ * arena_halloc -- allocates size bytes that mm_compact may move, and returns a handle to them:
+ * *handle is the payload (16-byte aligned) until the next mm_compact, which updates it
+ * handle blocks always live in the heap, whatever their size
+ * Returns the handle, or NULL
+ */
+static void **arena_halloc(size_t size) {
+    void **slot;
+    char *bp;
+
+    if (size <= 0) {
+        return NULL;
+    }
+    if (arena->free_handles == NULL && handle_grow() < 0) {
+        return NULL;
+    }
+    if (__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED) != NULL) {
+        free_remote();
+    }
+
+    /* room for the back pointer in front of the payload, which keeps it aligned */
+    if ((bp = alloc_block(adjust_size(size + DSIZE))) == NULL) {
+        return NULL;
+    }
+
+    slot = arena->free_handles;
+    arena->free_handles = *slot;
+    PUT(HDRP(bp), GET(HDRP(bp)) | HANDLE_BIT);
+    PUT(bp, (size_t) slot);
+    *slot = PADD(bp, DSIZE);
+    return slot;
+}
+
+/*
+ * arena_hfree -- frees the block of a handle and the handle itself
+ * PRECONDITION: handle was returned by mm_halloc of the calling thread and not freed since
+ */
+static void arena_hfree(void **handle) {
+    char *bp = PSUB(*handle, DSIZE);
+
+    *handle = arena->free_handles;
+    arena->free_handles = handle;
+
+    PUT(HDRP(bp), GET(HDRP(bp)) & ~HANDLE_BIT);
+    mm_free(bp);
+}
+
+/*
+ * arena_compact -- slides every handle block of the calling thread's heap down over the free
+ * space in front of it and updates its handle, in one walk over the heap. The free space
+ * between two blocks that can not move becomes one free block, and the free space after
+ * the last of them is coalesced at the end of the heap, which trims it.
+ * Cached and deferred blocks are freed first, so they do not stand in the way.
+ * Returns by how many bytes the heap shrank
+ */
+static size_t arena_compact(void) {
+    mem_region_t *region = arena->region;
+    size_t before = region->brk - region->start_brk;
+    char *dst = NULL;   /* start (header) of the free space gathered so far, NULL if none */
+    char *bp, *next;
+    size_t size;
+
+    if (__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED) != NULL) {
+        free_remote();
+    }
+    tcache_flush();
+    quick_sweep();
+
+    for (bp = NEXT_BLKP(arena->heap_start); (size = GET_SIZE(HDRP(bp))) > 0; bp = next) {
+        next = NEXT_BLKP(bp);
+
+        if (!GET_ALLOC(HDRP(bp))) {
+            /* free space joins the gap (a free block always follows an allocated one) */
+            ll_remove(bp);
+            if (dst == NULL) {
+                dst = HDRP(bp);
+            }
+        } else if (GET(HDRP(bp)) & HANDLE_BIT) {
+            if (dst != NULL) {
+                /* header, payload (and footer) move together; the block before is allocated */
+                memmove(dst, HDRP(bp), size);
+                PUT(dst, PACK(size, 1 | PREV_ALLOC_BIT | HANDLE_BIT));
+                bp = PADD(dst, WSIZE);
+                *(void **) GET(bp) = PADD(bp, DSIZE);
+                dst = PADD(dst, size);
+            }
+        } else if (dst != NULL) {
+            compact_gap(dst, HDRP(bp));
+            dst = NULL;
+        }
+    }
+    if (dst != NULL) {
+        compact_gap(dst, HDRP(bp));
+    }
+
+    return before - (region->brk - region->start_brk);
+}
+
+/*
+ * mm_tcache_stats -- reports how many small mallocs of the calling thread's arena
+ * looked in the small-block cache (lookups) and how many were served from it (hits)
+ * since the arena was created; both are 0 when the cache is turned off
+ */
+void mm_tcache_stats(size_t *lookups, size_t *hits) {
+    *lookups = arena->tcache_lookups;
+    *hits = arena->tcache_hits;
+}
+
+/*
+ * arena_heap_snapshot -- describes the calling thread's heap in snap: what the allocated,
+ * cached and free blocks add up to, a histogram of free block sizes, the length of every
+ * free list (for the class of the best-fit tree, the number of blocks in the tree) and 
+ * the large blocks in the direct table, which are counted for all arenas
+ * the free granules of zone chunks count as cached bytes
+ * walks the whole heap, so it costs time linear in the number of blocks
+ */
+static void arena_heap_snapshot(mm_heap_t *snap) {
+    char *bp;
+    size_t size;
+    size_t zone_blocks = 0;     /* blocks in zone chunks, which have no header */
+    size_t zone_headers = 0;    /* ... and the chunk headers and tags they pay instead */
+    int k;
+
+    memset(snap, 0, sizeof(*snap));
+    snap->heap_bytes = arena->region->brk - arena->region->start_brk;
+
+    for (bp = arena->heap_start; (size = GET_SIZE(HDRP(bp))) > 0; bp = NEXT_BLKP(bp)) {
+        if (bp == arena->heap_start) {
+            continue;                                   /* the prologue */
+        }
+#if BITMAP_ZONE
+        if (zone_contains(arena, bp)) {
+            /* one allocated block per end bit; the free granules are held like cached blocks */
+            zone_chunk_t *chunk = (zone_chunk_t *) bp;
+            size_t blocks = 0;
+
+            for (k = 0; k < ZONE_WORDS; k++) {
+                blocks += __builtin_popcountll(chunk->ends[k]);
+            }
+            snap->alloc_blocks += blocks;
+            snap->alloc_bytes += size;
+            snap->cached_bytes += chunk->nfree * DSIZE;
+            zone_blocks += blocks;
+            zone_headers += size - ZONE_GRANULES * DSIZE;
+            continue;
+        }
+#endif
+        if (GET_ALLOC(HDRP(bp))) {
+            snap->alloc_blocks++;
+            snap->alloc_bytes += size;
+            continue;
+        }
+        snap->free_blocks++;
+        snap->free_bytes += size;
+        snap->largest_free = max(snap->largest_free, size);
+        k = 0;
+        while (k < MM_HEAP_BUCKETS - 1 && (size >> (k + 1)) > 0) {
+            k++;
+        }
+        snap->free_hist[k]++;
+    }
+
+    /* cached blocks (and deferred ones) look allocated on the heap */
+    for (k = 0; k < TCACHE_CLASSES; k++) {
+        for (bp = arena->tcache[k]; bp != NULL; bp = (char *) GET(bp)) {
+            snap->cached_blocks++;
+            snap->cached_bytes += GET_SIZE(HDRP(bp));
+        }
+    }
+#if DEFERRED_COALESCE
+    for (k = 0; k < QUICK_CLASSES; k++) {
+        for (bp = arena->quick[k]; bp != NULL; bp = (char *) GET(bp)) {
+            snap->cached_blocks++;
+            snap->cached_bytes += GET_SIZE(HDRP(bp));
+        }
+    }
+#endif
+    snap->alloc_blocks -= snap->cached_blocks;
+    snap->alloc_bytes -= snap->cached_bytes;
+    snap->header_bytes = (snap->alloc_blocks - zone_blocks) * ALLOC_OVERHEAD + zone_headers;
+
+    snap->num_classes = min(NUM_CLASSES, MM_HEAP_CLASSES);
+    for (k = 0; k < snap->num_classes; k++) {
+        if (BEST_FIT_TREE && k == size_class(TREE_MIN)) {
+            snap->list_len[k] = tree_count((void *) *TREE_ROOT());
+            continue;
+        }
+        for (bp = (char *) LL_NEXT(SEG_ROOT(k)); bp != NULL; bp = (char *) LL_NEXT(bp)) {
+            snap->list_len[k]++;
+        }
+    }
+
+    pthread_mutex_lock(&direct_lock);
+    for (size_t i = 0; i < direct_slots; i++) {
+        if (direct_table[i].start != NULL && direct_table[i].start != DIRECT_DELETED) {
+            snap->mapped_blocks++;
+            snap->mapped_bytes += direct_table[i].size;
+        }
+    }
+    pthread_mutex_unlock(&direct_lock);
+}
+
+/*
+ * arena_realloc -- resize the block whose payload is pointed to by ptr to hold size bytes
+ * takes the payload pointer of an allocated block (or NULL) and the new payload size
+ * returns the payload pointer of the resized block, which keeps the first 
+ * min(old, new) bytes of the old payload; returns NULL if size is 0 or the heap is full
+ * the block is only moved (and copied) when it can not grow in place:
+ *      1. shrinking always happens in place, the unused tail is split off as a free block
+ *      2. growing first absorbs a free right neighbor
+ *      3. a block at the end of the heap (possibly behind one free block) grows by 
+ *         extending the heap by exactly the missing amount
+ *      4. anything else is moved to a block from mm_malloc
+ * the block keeps at most 1/REALLOC_SLACK of its new size as room for growing in place
+ * again (a block that keeps growing by a few bytes would otherwise move every time a
+ * small block lands behind it); whatever it has beyond that is split off
+ * a large block with its own pages is remapped, or moved to the heap if it became small
+ * PRECONDITION: ptr is NULL or was returned by an earlier mm_malloc/mm_realloc and not freed
+ */
+static void *arena_realloc(void *ptr, size_t size) {
+    size_t asize;       /* adjusted block size */
+    size_t oldsize;     /* current block size */
+    size_t available;   /* oldsize plus whatever the right neighbor can give */
+    void *next;         /* right neighbor of ptr on the heap */
+    void *newp;         /* block the payload is moved to when growing in place fails */
+
+    /* realloc(NULL, size) is malloc and realloc(ptr, 0) is free */
+    if (ptr == NULL) {
+        return mm_malloc(size);
+    }
+    if (size == 0) {
+        mm_free(ptr);
+        return NULL;
+    }
+
+    /* a large block has no header, its size is in the direct table */
+    if (MMAP_THRESHOLD && heap_of(ptr) == NULL && (oldsize = direct_size(ptr)) > 0) {
+        if (IS_LARGE(size)) {
+            return direct_realloc(ptr, oldsize, size);
+        }
+        if ((newp = mm_malloc(size)) == NULL) {
+            return NULL;
+        }
+        memcpy(newp, ptr, size);
+        direct_free(ptr);
+        return newp;
+    }
+
+#if BITMAP_ZONE
+    /* a zone block keeps its granules if they still hold size bytes, otherwise it moves */
+    if (zone_contains(__atomic_load_n(&num_arenas, __ATOMIC_RELAXED) > 0 ? arena_of(ptr) : arena, ptr)) {
+        oldsize = zone_size(ptr);
+        if ((size + DSIZE - 1) / DSIZE == oldsize / DSIZE && zone_contains(arena, ptr)) {
+            return ptr;
+        }
+        if ((newp = mm_malloc(size)) == NULL) {
+            return NULL;
+        }
+        memcpy(newp, ptr, min(oldsize, size));
+        mm_free(ptr);
+        return newp;
+    }
+#endif
+
+    asize = adjust_size(size);
+    oldsize = GET_SIZE(HDRP(ptr));
+
+    /* a block of another thread's arena can not be resized here: move it into this arena */
+    if (__atomic_load_n(&num_arenas, __ATOMIC_RELAXED) > 0 && arena_of(ptr) != arena) {
+        if ((newp = mm_malloc(size)) == NULL) {
+            return NULL;
+        }
+        memcpy(newp, ptr, min(oldsize - ALLOC_OVERHEAD, size));
+        mm_free(ptr);
+        return newp;
+    }
+
+    /* shrinking (or no change): give back the tail beyond the slack if it is big enough to be a block */
+    if (asize <= oldsize) {
+        split_tail(ptr, realloc_keep(asize, oldsize));
+        return ptr;
+    }
+
+    next = NEXT_BLKP(ptr);
+    available = oldsize;
+    if (!GET_ALLOC(HDRP(next))) {
+        available += GET_SIZE(HDRP(next));
+    }
+
+    /* if the block is the last one (ignoring a free right neighbor) the heap can be grown under it;
+     * extend_heap coalesces the new space with the free neighbor, so next is always free afterwards;
+     * the heap grows by the slack too, so the next few small steps of a growing block fit in place */
+    if (available < asize && 
+        (GET_SIZE(HDRP(next)) == 0 || (!GET_ALLOC(HDRP(next)) && GET_SIZE(HDRP(NEXT_BLKP(next))) == 0))) {
+        if ((next = extend_heap(max(realloc_keep(asize, SIZE_MAX) - available, MIN_B_SIZE) / WSIZE)) == NULL) {
+            return NULL;
+        }
+        available = oldsize + GET_SIZE(HDRP(next));
+    }
+
+    /* grow in place by absorbing the free right neighbor, and give back what is beyond the slack */
+    if (available >= asize) {
+        ll_remove(next);
+        set_alloc(ptr, available);
+        split_tail(ptr, realloc_keep(asize, available));
+        return ptr;
+    }
+
+    /* a block that became large moves to pages of its own */
+    if (IS_LARGE(size)) {
+        if ((newp = direct_alloc(size)) == NULL) {
+            return NULL;
+        }
+        memcpy(newp, ptr, oldsize - ALLOC_OVERHEAD);
+        mm_free(ptr);
+        return newp;
+    }
+
+    /* last resort: move the payload to a block from mm_malloc, which reuses free memory
+     * anywhere in the heap before it grows the heap; the block gets the slack up front */
+    if ((newp = mm_malloc(realloc_keep(asize, SIZE_MAX) - ALLOC_OVERHEAD)) == NULL &&
+        (newp = mm_malloc(size)) == NULL) {
+        return NULL;
+    }
+    memcpy(newp, ptr, oldsize - ALLOC_OVERHEAD);
+    mm_free(ptr);
+    return newp;
+}
+
+
+/* The remaining routines are internal helper routines */
+
+/*
+ * arena_init -- create the initial heap of new_arena in region: the segregated list roots,
+ * prologue and epilogue, then a first free block of CHUNKSIZE bytes
+ * returns 0 if sucsessful and -1 if the region is too small
+ * new_arena becomes the calling thread's arena
+ */
+static int arena_init(arena_t *new_arena, mem_region_t *region) {
+    void *start;
+
+    arena = new_arena;
+    /* atomic since arena_of may scan this slot meanwhile; it can not be asked about 
+     * a block of the region before the heap below is set up */
+    __atomic_store_n(&arena->region, region, __ATOMIC_RELAXED);
+    arena->remote_frees = NULL;
+    for (int i = 0; i < TCACHE_CLASSES; i++) {
+        arena->tcache[i] = NULL;
+        arena->tcache_count[i] = 0;
+    }
+    arena->tcache_lookups = 0;
+    arena->tcache_hits = 0;
+    arena->free_handles = NULL;     // memlib unmapped the slot pages of an earlier heap
+#if DEFERRED_COALESCE
+    for (int i = 0; i < QUICK_CLASSES; i++) {
+        arena->quick[i] = NULL;
+    }
+    arena->quick_bytes = 0;
+#endif
+#if BITMAP_ZONE
+    arena->zone_chunks = NULL;
+    arena->zone_spare = NULL;
+    memset(arena->zone_map, 0, sizeof(arena->zone_map));
+#endif
+
     /* create the initial empty heap */
-    if ((heap_start = mem_sbrk(4 * WSIZE)) == NULL)
+    if ((start = mem_region_sbrk(region, (NUM_CLASSES + 3) * WSIZE)) == (void *)-1)
         return -1;
 
-    /* linked list start is placed at the padding of the heap; it initially points to 0 signaling 
-     * that the linked list is empty(empty) 
+    /* start the heap at the (size 0) payload of the prologue block, 
+     * which sits right after the roots of the segregated lists 
      */
-    PUT(heap_start, (size_t) 0);
+    arena->heap_start = PADD(start, (NUM_CLASSES + 1) * WSIZE);
+
+    /* every list root initially points to 0 signaling that the list is empty */
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        PUT(SEG_ROOT(i), (size_t) 0);
+    }
+
+    PUT(HDRP(arena->heap_start), PACK(OVERHEAD, 1));    /* prologue header */ 
+    PUT(arena->heap_start, PACK(OVERHEAD, 1));          /* prologue footer */
+    PUT(PADD(arena->heap_start, WSIZE), PACK(0, 1 | PREV_ALLOC_BIT)); /* epilogue header */
+    
+    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
+    if (extend_heap(CHUNKSIZE / WSIZE) == NULL)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * arena_key_create -- create the key whose destructor runs arena_release at thread exit
+ */
+static void arena_key_create(void) {
+    pthread_key_create(&arena_key, arena_release);
+}
+
+/*
+ * arena_release -- destructor of arena_key: put the slot of an exiting thread's arena on
+ * free_slots, heap and all, for the next thread that calls mm_thread_init. Blocks of it
+ * that other threads free meanwhile wait on its remote-free stack for that thread.
+ * An arena from before the last mm_init is gone already and is not given back.
+ */
+static void arena_release(void *slot_arena) {
+    pthread_mutex_lock(&arenas_lock);
+    if (arena_epoch == arenas_epoch) {
+        free_slots[num_free_slots++] = (arena_t *) slot_arena - arenas;
+    }
+    pthread_mutex_unlock(&arenas_lock);
+    arena = &main_arena;
+}
+
+/*
+ * arena_lock -- take main_lock if the calling thread uses the main arena and does not hold it yet
+ */
+static void arena_lock(void) {
+    if (arena == &main_arena && main_depth++ == 0) {
+        pthread_mutex_lock(&main_lock);
+    }
+}
+
+/*
+ * arena_unlock -- undo the matching arena_lock
+ */
+static void arena_unlock(void) {
+    if (arena == &main_arena && --main_depth == 0) {
+        pthread_mutex_unlock(&main_lock);
+    }
+}
+
+/*
+ * heap_of -- returns the arena whose heap region holds bp (the calling thread's is
+ * checked first), or NULL if none does, which makes bp a large block
+ */
+static arena_t *heap_of(void *bp) {
+    arena_t *owner;
+
+    if (mem_region_contains(arena->region, bp)) {
+        return arena;
+    }
+    owner = __atomic_load_n(&num_arenas, __ATOMIC_RELAXED) > 0 ? arena_of(bp) : &main_arena;
+    return mem_region_contains(owner->region, bp) ? owner : NULL;
+}
+
+/*
+ * arena_of -- returns the arena whose region holds bp (the main arena if no thread arena does)
+ */
+static arena_t *arena_of(void *bp) {
+    int n = __atomic_load_n(&num_arenas, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < n && i < MAX_ARENAS; i++) {
+        mem_region_t *region = __atomic_load_n(&arenas[i].region, __ATOMIC_ACQUIRE);
+        if (region && mem_region_contains(region, bp)) {
+            return &arenas[i];
+        }
+    }
+    return &main_arena;
+}
+
+/*
+ * tcache_flush -- empty every small-block cache stack of the calling thread's arena,
+ * putting the blocks on the free lists (coalesced) like an uncached free would
+ */
+static void tcache_flush(void) {
+    for (int class = 0; class < TCACHE_CLASSES; class++) {
+        void *bp = arena->tcache[class];
+
+        arena->tcache[class] = NULL;
+        arena->tcache_count[class] = 0;
+        while (bp != NULL) {
+            void *next = (void *) GET(bp);
+            set_free(bp, GET_SIZE(HDRP(bp)));
+            coalesce(bp);
+            bp = next;
+        }
+    }
+}
+
+/*
+ * quick_sweep -- free every block on the quick lists of the calling thread's arena:
+ * mark it free and coalesce it with its neighbors, which may be blocks swept before it
+ */
+static void quick_sweep(void) {
+#if DEFERRED_COALESCE
+    for (int class = 0; class < QUICK_CLASSES; class++) {
+        void *bp = arena->quick[class];
+
+        arena->quick[class] = NULL;
+        while (bp != NULL) {
+            void *next = (void *) GET(bp);
+            set_free(bp, GET_SIZE(HDRP(bp)));
+            coalesce_release(bp);
+            bp = next;
+        }
+    }
+    arena->quick_bytes = 0;
+#endif
+}
+
+/*
+ * free_remote -- free every block other threads pushed onto this arena's remote-free stack
+ */
+static void free_remote(void) {
+    void *bp = __atomic_exchange_n(&arena->remote_frees, NULL, __ATOMIC_ACQUIRE);
+
+    while (bp != NULL) {
+        void *next = (void *) GET(bp);
+        free_block(bp);
+        bp = next;
+    }
+}
+
+/*
+ * realloc_keep -- returns how much of a bsize block resized to asize bytes it keeps:
+ * asize plus up to 1/REALLOC_SLACK of it (double-word aligned) as room to grow in place
+ */
+static size_t realloc_keep(size_t asize, size_t bsize) {
+    size_t keep = asize + asize / REALLOC_SLACK / DSIZE * DSIZE;
+    return keep < bsize ? keep : bsize;
+}
+
+/*
+ * adjust_size -- returns the block size needed for a payload of size bytes:
+ * the payload plus the tags of an allocated block, rounded up to the double-word 
+ * alignment and never less than the minimum block size
+ */
+static size_t adjust_size(size_t size) {
+    /* Add overhead and then round up to nearest multiple of double-word alignment */
+    return max(MIN_B_SIZE, DSIZE * ((size + ALLOC_OVERHEAD + (DSIZE - 1)) / DSIZE));
+}
+
+/*
+ * set_alloc -- write the tags of an allocated block of size bytes at bp (header, plus
+ * footer unless FOOTERLESS) and tell the next block that its left neighbor is allocated
+ * the prev-alloc bit already in bp's header is kept
+ */
+static void set_alloc(void *bp, size_t size) {
+    PUT(HDRP(bp), PACK(size, 1 | GET_PREV_ALLOC_BIT(HDRP(bp))));
+#if FOOTERLESS
+    void *next_header = HDRP(NEXT_BLKP(bp));
+    PUT(next_header, GET(next_header) | PREV_ALLOC_BIT);
+#else
+    PUT(FTRP(bp), PACK(size, 1));
+#endif
+}
+
+/*
+ * set_free -- write the header and footer of a free block of size bytes at bp
+ * and tell the next block that its left neighbor is free
+ * the prev-alloc bit already in bp's header is kept
+ */
+static void set_free(void *bp, size_t size) {
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC_BIT(HDRP(bp))));
+    PUT(FTRP(bp), size);
+#if FOOTERLESS
+    void *next_header = HDRP(NEXT_BLKP(bp));
+    PUT(next_header, GET(next_header) & ~PREV_ALLOC_BIT);
+#endif
+}
+
+/*
+ * split_tail -- shrink the allocated block bp to asize bytes and free the rest
+ * the remainder is only split off when it is large enough to be its own block,
+ * and it is coalesced so it merges with a free block to its right
+ * PRECONDITION: bp is allocated and its size is at least asize
+ */
+static void split_tail(void *bp, size_t asize) {
+    size_t unalloc_size = GET_SIZE(HDRP(bp)) - asize;
+
+    if (unalloc_size < MIN_B_SIZE) {
+        return;
+    }
+
+    set_alloc(bp, asize);
+
+    void *rest = NEXT_BLKP(bp);
+    PUT(HDRP(rest), PACK(0, PREV_ALLOC_BIT));   // the left neighbor of rest is bp
+    set_free(rest, unalloc_size);
+    coalesce_release(rest);
+}
+
+/*
+ * coalesce_release -- coalesce the newly freed block bp and give the pages of the
+ * result back to the OS if it is big. A free neighbor of DECOMMIT_THRESHOLD bytes or
+ * more had its pages released when it was freed, so only the rest is released now.
+ * Returns the coalesced block
+ * PRECONDITION: bp is marked free but not on a free list
+ */
+static void *coalesce_release(void *bp) {
+    void *lo = HDRP(bp);                            // start of the memory that may still be committed
+    void *hi = PADD(lo, GET_SIZE(HDRP(bp)));        // ... and its end
+    void *next = NEXT_BLKP(bp);
+
+    if (!PREV_ALLOC(bp) && GET_SIZE(HDRP(PREV_BLKP(bp))) < DECOMMIT_THRESHOLD) {
+        lo = HDRP(PREV_BLKP(bp));
+    }
+    if (!GET_ALLOC(HDRP(next)) && GET_SIZE(HDRP(next)) < DECOMMIT_THRESHOLD) {
+        hi = PADD(hi, GET_SIZE(HDRP(next)));
+    }
 
+    bp = coalesce(bp);
+    release_pages(bp, lo, hi);
+    return bp;
+}
 
-    PUT(PADD(heap_start, WSIZE), PACK(OVERHEAD, 1));    /* prologue header */ 
-    PUT(PADD(heap_start, DSIZE), PACK(OVERHEAD, 1));    /* prologue footer */
-    PUT(PADD(heap_start, WSIZE + DSIZE), PACK(0, 1));   /* epilogue header */
+/*
+ * direct_alloc -- give a large request of size bytes pages of its own and record them
+ * in the direct table; returns the payload (the start of the mapping) or NULL
+ */
+static void *direct_alloc(size_t size) {
+    size_t pagesize = mem_pagesize();
+    void *bp = NULL;
 
-    heap_start = PADD(heap_start, DSIZE); /* start the heap at the (size 0) payload of the prologue block */
-    
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE / WSIZE) == NULL)
-        return -1;
+    size = (size + pagesize - 1) & ~(pagesize - 1);
 
-    return 0;
+    pthread_mutex_lock(&direct_lock);
+    if (direct_reserve() == 0 && (bp = mem_map(size)) != NULL) {
+        direct_put(bp, size);
+    }
+    pthread_mutex_unlock(&direct_lock);
+    return bp;
 }
 
-
 /*
- * mm_malloc -- allocates a 16-byte aligned chunk of memory that correcponds to the size argument
- * this function takes a 'size' argument, which is the size of the block to allocate
- * This function returns a void*, which is the pointer to the payload of the now allocated chunk of memory
- * mm_malloc does not have preconditions/postconditions besides relying on the place function
+ * direct_size -- returns the size of the mapping of the large block bp,
+ * or 0 if bp is not a large block
  */
-void *mm_malloc(size_t size) {
-    size_t asize;      /* adjusted block size */
-    size_t extendsize; /* amount to extend heap if no fit */
-    char *bp;          /* address of the block that will be returned */
+static size_t direct_size(void *bp) {
+    direct_t *slot;
+    size_t size = 0;
 
-    /* Ignore spurious requests */
-    if (size <= 0){ 
-        return NULL;
+    pthread_mutex_lock(&direct_lock);
+    if ((slot = direct_find(bp)) != NULL) {
+        size = slot->size;
     }
-    /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE) {
-        asize = DSIZE + OVERHEAD;
-    } else {
-        /* Add overhead and then round up to nearest multiple of double-word alignment */
-        asize = DSIZE * ((size + (OVERHEAD) + (DSIZE - 1)) / DSIZE);
+    pthread_mutex_unlock(&direct_lock);
+    return size;
+}
+
+/*
+ * direct_free -- if bp is a large block, unmap it, forget it and return true;
+ * otherwise return false
+ */
+static bool direct_free(void *bp) {
+    direct_t *slot;
+    size_t size = 0;
+
+    pthread_mutex_lock(&direct_lock);
+    if ((slot = direct_find(bp)) != NULL) {
+        size = slot->size;
+        slot->start = DIRECT_DELETED;   // keeps the probe sequences of other blocks intact
     }
+    pthread_mutex_unlock(&direct_lock);
 
-    /* Search the free list for a fit */
-    if ((bp = find_fit(asize)) != NULL) {
-        place(bp, asize);
+    if (size == 0) {
+        return false;
+    }
+    mem_unmap(bp, size);
+    return true;
+}
+
+/*
+ * direct_realloc -- resize the mapping of the large block bp (oldsize bytes) to hold size
+ * bytes; returns the possibly moved block, or NULL (and bp is unchanged)
+ */
+static void *direct_realloc(void *bp, size_t oldsize, size_t size) {
+    size_t pagesize = mem_pagesize();
+    void *newp = NULL;
+
+    size = (size + pagesize - 1) & ~(pagesize - 1);
+    if (size == oldsize) {
         return bp;
     }
-    /* No fit found. Get more memory and place the block */
-    extendsize = max(asize, CHUNKSIZE);
-    if ((bp = extend_heap(extendsize / WSIZE)) == NULL){
-        return NULL;
+
+    pthread_mutex_lock(&direct_lock);
+    if (direct_reserve() == 0 && (newp = mem_remap(bp, oldsize, size)) != NULL) {
+        direct_find(bp)->start = DIRECT_DELETED;
+        direct_put(newp, size);
     }
+    pthread_mutex_unlock(&direct_lock);
+    return newp;
+}
 
-    place(bp, asize);
-    return bp;
+/*
+ * direct_find -- returns the slot of the large block bp in the direct table, or NULL
+ * PRECONDITION: the caller holds direct_lock
+ */
+static direct_t *direct_find(void *bp) {
+    if (direct_table == NULL) {
+        return NULL;
+    }
+    for (size_t i = ((size_t) bp >> 12) & (direct_slots - 1); direct_table[i].start != NULL; 
+         i = (i + 1) & (direct_slots - 1)) {
+        if (direct_table[i].start == bp) {
+            return &direct_table[i];
+        }
+    }
+    return NULL;
 }
 
 /*
- * mm_free -- free the block whose payload is pointed to by the given argument (bp)
- * the function takes in a pointer to the block that will be freed
- * This fuction doesn't return anything
- * This function assumes the payload was provided my mm_malloc and has not already been freed 
- * PRECONDITION: The payload was returned by an earlier call to mm_malloc
- * PRECONDITION: The payload has not been previously freed since its most recent return
- * from malloc 
+ * direct_reserve -- make sure the direct table has room for one more block, keeping it at
+ * most half full; a full table is rebuilt twice as big (or just without its deleted slots)
+ * returns 0 if sucsessful and -1 if the new table could not be mapped
+ * PRECONDITION: the caller holds direct_lock
  */
-void mm_free(void *bp) {
-    /* Calculate what the header/footer would be unallocated:
-     * because of alignment, the size of any block will end in a zero
-     * so setting the header to be the size of the block also marks the block
-     * as unallocated 
-     */
-    size_t newhead = GET_SIZE(HDRP(bp));
+static int direct_reserve(void) {
+    direct_t *old_table = direct_table;
+    size_t old_slots = direct_slots;
+    size_t live = 0;
 
-    //Update the header and footer
-    PUT(HDRP(bp), newhead);
-    PUT(FTRP(bp), newhead);
+    if (2 * (direct_used + 1) <= direct_slots) {
+        return 0;
+    }
+    for (size_t i = 0; i < old_slots; i++) {
+        live += old_table[i].start != NULL && old_table[i].start != DIRECT_DELETED;
+    }
 
-    ll_add(bp);     //add newly freeded block to the linked list
-    coalesce(bp);   //check to see if the newly freed block can be coalesced
+    direct_slots = max(DIRECT_MIN_SLOTS, 4 * (live + 1) > old_slots ? 2 * old_slots : old_slots);
+    if ((direct_table = mem_map(direct_slots * sizeof(direct_t))) == NULL) {
+        direct_table = old_table;
+        direct_slots = old_slots;
+        return -1;
+    }
+    direct_used = 0;
+    for (size_t i = 0; i < old_slots; i++) {
+        if (old_table[i].start != NULL && old_table[i].start != DIRECT_DELETED) {
+            direct_put(old_table[i].start, old_table[i].size);
+        }
+    }
+    if (old_table != NULL) {
+        mem_unmap(old_table, old_slots * sizeof(direct_t));
+    }
+    return 0;
 }
 
+/*
+ * direct_put -- record the large block start with a mapping of size bytes
+ * PRECONDITION: the caller holds direct_lock and direct_reserve made room
+ */
+static void direct_put(void *start, size_t size) {
+    size_t i = ((size_t) start >> 12) & (direct_slots - 1);
 
+    while (direct_table[i].start != NULL) {
+        i = (i + 1) & (direct_slots - 1);
+    }
+    direct_table[i].start = start;
+    direct_table[i].size = size;
+    direct_used++;
+}
 
-
-/* The remaining routines are internal helper routines */
+/*
+ * release_pages -- give the memory of a big free block back to the OS: a block at the
+ * end of the heap is trimmed to CHUNKSIZE bytes by shrinking the heap, the pages of
+ * [lo, hi) inside any other block are decommitted. Small blocks are left alone.
+ * PRECONDITION: bp is a coalesced free block on its free list
+ */
+static void release_pages(void *bp, void *lo, void *hi) {
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (size >= TRIM_THRESHOLD && GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0) {
+        ll_remove(bp);  // the block changes size class
+        if (mem_region_sbrk(arena->region, -(int)(size - CHUNKSIZE)) != (void *)-1) {
+            PUT(HDRP(bp), PACK(CHUNKSIZE, GET_PREV_ALLOC_BIT(HDRP(bp))));
+            PUT(FTRP(bp), PACK(CHUNKSIZE, 0));
+            PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));   // new epilogue header, its left neighbor is free
+        }
+        ll_add(bp);
+    } else if (size >= DECOMMIT_THRESHOLD) {
+        // keep the header and list links at the front and the footer at the back
+        lo = (char *) max((size_t) lo, (size_t) PADD(bp, DSIZE));
+        hi = (char *) min((size_t) hi, (size_t) FTRP(bp));
+        if (lo < hi) {
+            mem_decommit(lo, (char *) hi - (char *) lo);
+        }
+    }
+}
 
 /*
  * place -- Place block of asize bytes at start of free block bp
@@ -237,37 +1695,336 @@ static void place(void *bp, size_t asize) {
     // Unalloc_size is the amount of memory not needed for the given payload and its packaging
     size_t unalloc_size = GET_SIZE(HDRP(bp)) - asize;
 
+    // remove bp from its free list while its header still names the right size class
+    ll_remove(bp); 
+
     // if there is a remainder that is too small to turn into its own block, make the 
     // newly allocated block contain the additional memory
-    if (((int)unalloc_size - 32) < 0) { 
-        size_t size = GET_SIZE(HDRP(bp));
-
+    if (unalloc_size < MIN_LIST_SIZE) { 
         // updated the existing hearder to now indicate that it is allocated
-        PUT(HDRP(bp), PACK(size, 1)); 
-        PUT(FTRP(bp), PACK(size, 1)); 
+        set_alloc(bp, GET_SIZE(HDRP(bp)));
     } else { // if there is no remainder OR a remainder that is large enough to be split into its own block
         // Update header to be an allocated block of the minimume viable size for the payload
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
+        set_alloc(bp, asize);
 
-        // Create a new free block of unalloc_size bytes 
+        // Create a new free block of unalloc_size bytes, whose left neighbor is bp
         size_t* next = (size_t*) NEXT_BLKP(bp);
-        PUT(HDRP(next), unalloc_size);
-        PUT(FTRP(next), unalloc_size);
-        ll_add(next); // add newly free block to the linked list
+        PUT(HDRP(next), PACK(0, PREV_ALLOC_BIT));
+        set_free(next, unalloc_size);
+        ll_add(next); // add newly free block to the free list of its size class
+    }
+}
+
+
+/*
+ * carve -- allocates up to n blocks of asize bytes one after another from the start of the
+ * free block bp, stores their payloads in ptrs and puts what is left back on a free list
+ * a remainder too small to be a block of its own goes to the last block, as in place
+ * Returns the number of blocks allocated, at least 1
+ * PRECONDITION: bp is a free block of at least asize bytes on a free list
+ */
+static int carve(void *bp, size_t asize, void **ptrs, int n) {
+    size_t size = GET_SIZE(HDRP(bp));
+    int count = min(n, size / asize);
+    size_t rest = size - count * asize;
+
+    ll_remove(bp);
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            PUT(HDRP(bp), PACK(0, PREV_ALLOC_BIT));  // the left neighbor is the block before
+        }
+        set_alloc(bp, (i == count - 1 && rest < MIN_LIST_SIZE) ? asize + rest : asize);
+        ptrs[i] = bp;
+        bp = NEXT_BLKP(bp);
+    }
+    if (rest >= MIN_LIST_SIZE) {
+        PUT(HDRP(bp), PACK(0, PREV_ALLOC_BIT));
+        set_free(bp, rest);
+        ll_add(bp);
+    }
+    return count;
+}
+
+/*
+ * handle_grow -- maps a page of HANDLE_CHUNK handle slots and puts them on the free slot list
+ * Returns 0, or -1 if no memory could be mapped
+ */
+static int handle_grow(void) {
+    void **slots;
+
+    if ((slots = mem_map(HANDLE_CHUNK * sizeof(void *))) == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < HANDLE_CHUNK; i++) {
+        slots[i] = (i + 1 < HANDLE_CHUNK) ? (void *) &slots[i + 1] : arena->free_handles;
+    }
+    arena->free_handles = slots;
+    return 0;
+}
+
+/*
+ * compact_gap -- turns the space from lo (where a header goes) up to hi (the header of the
+ * next block) into a free block and coalesces it, which releases its pages if it is big
+ * PRECONDITION: the block before lo is allocated, and the space holds no free-list block
+ */
+static void compact_gap(char *lo, char *hi) {
+    char *bp = PADD(lo, WSIZE);
+
+    PUT(lo, PACK(0, PREV_ALLOC_BIT));
+    set_free(bp, hi - lo);
+    coalesce_release(bp);
+}
+
+/*
+ * zone_contains -- true if bp lies in a zone chunk of the arena owner, which is a lookup
+ * in the owner's chunk map by the ZONE_CHUNK-aligned address of bp
+ * always false without BITMAP_ZONE
+ */
+static bool zone_contains(arena_t *owner, void *bp) {
+#if BITMAP_ZONE
+    size_t i = (size_t) bp / ZONE_CHUNK - (size_t) owner->region->start_brk / ZONE_CHUNK;
+
+    return i < ZONE_MAP_WORDS * 64 && (owner->zone_map[i / 64] >> (i % 64)) & 1;
+#else
+    return false;
+#endif
+}
+
+#if BITMAP_ZONE
+/*
+ * zone_alloc -- allocates n granules (at most 16) in a zone chunk of the calling thread's
+ * arena: in the first chunk on its list with a run of n free granules, else in the spare
+ * chunk, else in a new chunk
+ * Returns the payload, or NULL if no chunk could be made (the caller falls back on the heap)
+ */
+static void *zone_alloc(size_t n) {
+    zone_chunk_t *chunk;
+    void *bp;
+
+    for (chunk = arena->zone_chunks; chunk != NULL; chunk = chunk->next) {
+        if (chunk->nfree >= n && (bp = zone_take(chunk, n)) != NULL) {
+            return bp;
+        }
+    }
+
+    if ((chunk = arena->zone_spare) != NULL) {
+        arena->zone_spare = NULL;
+    } else if ((chunk = zone_new()) == NULL) {
+        return NULL;
+    }
+    zone_push(chunk);
+    return zone_take(chunk, n);
+}
+
+/*
+ * zone_free -- frees the zone block bp: clears its granules in the occupancy bitmap, whose
+ * number is the distance to its end bit. A chunk that becomes empty is kept as the spare,
+ * or goes back to the heap if there already is one.
+ * PRECONDITION: bp is an allocated zone block of the calling thread's arena
+ */
+static void zone_free(void *bp) {
+    zone_chunk_t *chunk = (zone_chunk_t *) ((size_t) bp & ~(size_t) (ZONE_CHUNK - 1));
+    size_t g = ((char *) bp - (char *) chunk - ZONE_DATA) / DSIZE;
+    size_t bit = g % 64;
+    size_t n = __builtin_ctzll(chunk->ends[g / 64] >> bit) + 1;
+
+    chunk->used[g / 64] &= ~((((uint64_t) 1 << n) - 1) << bit);
+    chunk->ends[g / 64] &= ~((uint64_t) 1 << (bit + n - 1));
+    if (chunk->nfree == 0) {
+        zone_push(chunk);
+    }
+    chunk->nfree += n;
+
+    if (chunk->nfree == ZONE_GRANULES) {
+        zone_unlink(chunk);
+        if (arena->zone_spare == NULL) {
+            arena->zone_spare = chunk;
+        } else {
+            size_t i = (size_t) chunk / ZONE_CHUNK - (size_t) arena->region->start_brk / ZONE_CHUNK;
+
+            arena->zone_map[i / 64] &= ~((uint64_t) 1 << (i % 64));
+            free_block(chunk);
+        }
     }
+}
+
+/*
+ * zone_size -- returns the payload size of the zone block bp, all of its granules
+ */
+static size_t zone_size(void *bp) {
+    zone_chunk_t *chunk = (zone_chunk_t *) ((size_t) bp & ~(size_t) (ZONE_CHUNK - 1));
+    size_t g = ((char *) bp - (char *) chunk - ZONE_DATA) / DSIZE;
+
+    return (__builtin_ctzll(chunk->ends[g / 64] >> (g % 64)) + 1) * DSIZE;
+}
+
+/*
+ * zone_take -- allocates the lowest run of n free granules of chunk that does not cross
+ * a bitmap word, and takes the chunk off the list if it is full now
+ * Returns the payload, or NULL if the chunk has no such run
+ */
+static void *zone_take(zone_chunk_t *chunk, size_t n) {
+    int g = zone_search(chunk->used, n);
+    size_t bit;
+
+    if (g < 0) {
+        return NULL;
+    }
+    bit = g % 64;
+    chunk->used[g / 64] |= (((uint64_t) 1 << n) - 1) << bit;
+    chunk->ends[g / 64] |= (uint64_t) 1 << (bit + n - 1);
+    if ((chunk->nfree -= n) == 0) {
+        zone_unlink(chunk);
+    }
+    return PADD(chunk, ZONE_DATA + g * DSIZE);
+}
+
+/*
+ * zone_search -- finds the lowest granule that starts a run of n free granules in the
+ * ZONE_WORDS occupancy words used, without crossing from one word into the next
+ * The free bits are ANDed with themselves shifted right by 1, 2, 4, ... until bit i is
+ * set only if granules i to i+n-1 are all free; that takes log2(n) shifts per word, and
+ * with AVX2 (SSE2) all four words (two at a time) are shifted by one instruction.
+ * Returns the granule, or -1 if there is no such run
+ */
+static int zone_search(const uint64_t *used, size_t n) {
+    uint64_t runs[ZONE_WORDS];
+    size_t k, step;
+    int w;
+
+#if defined(__AVX2__)
+    __m256i r = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) used), _mm256_set1_epi64x(-1));
+
+    for (k = 1; k < n; k += step) {
+        step = min(k, n - k);
+        r = _mm256_and_si256(r, _mm256_srl_epi64(r, _mm_cvtsi32_si128((int) step)));
+    }
+    if (_mm256_testz_si256(r, r)) {
+        return -1;
+    }
+    _mm256_storeu_si256((__m256i *) runs, r);
+#elif defined(__SSE2__)
+    for (w = 0; w < ZONE_WORDS; w += 2) {
+        __m128i r = _mm_xor_si128(_mm_loadu_si128((const __m128i *) &used[w]), _mm_set1_epi64x(-1));
+
+        for (k = 1; k < n; k += step) {
+            step = min(k, n - k);
+            r = _mm_and_si128(r, _mm_srl_epi64(r, _mm_cvtsi32_si128((int) step)));
+        }
+        _mm_storeu_si128((__m128i *) &runs[w], r);
+    }
+#else
+    for (w = 0; w < ZONE_WORDS; w++) {
+        runs[w] = ~used[w];
+        for (k = 1; k < n; k += step) {
+            step = min(k, n - k);
+            runs[w] &= runs[w] >> step;
+        }
+    }
+#endif
+
+    for (w = 0; w < ZONE_WORDS; w++) {
+        if (runs[w] != 0) {
+            return w * 64 + __builtin_ctzll(runs[w]);
+        }
+    }
+    return -1;
+}
+
+/*
+ * zone_new -- gets a chunk of ZONE_CHUNK bytes at a multiple of ZONE_CHUNK from mm_memalign
+ * (chunks carved one after another sit back to back, see ZONE_BYTES), marks it in the
+ * arena's chunk map and sets every granule free
+ * Returns the chunk (on no list yet), or NULL
+ */
+static zone_chunk_t *zone_new(void) {
+    zone_chunk_t *chunk;
+    size_t i;
+
+    if ((chunk = mm_memalign(ZONE_CHUNK, ZONE_BYTES)) == NULL) {
+        return NULL;
+    }
+    i = (size_t) chunk / ZONE_CHUNK - (size_t) arena->region->start_brk / ZONE_CHUNK;
+    if (i >= ZONE_MAP_WORDS * 64) {
+        free_block(chunk);                      // beyond the map (a region larger than ARENA_SIZE)
+        return NULL;
+    }
+    arena->zone_map[i / 64] |= (uint64_t) 1 << (i % 64);
+
+    chunk->nfree = ZONE_GRANULES;
+    for (size_t w = 0; w < ZONE_WORDS; w++) {
+        /* the bits past the last granule stay set, so they never look free */
+        chunk->used[w] = (ZONE_GRANULES >= 64 * (w + 1)) ? 0 :
+                         (ZONE_GRANULES <= 64 * w) ? ~(uint64_t) 0 : ~(uint64_t) 0 << (ZONE_GRANULES % 64);
+        chunk->ends[w] = 0;
+    }
+    return chunk;
+}
+
+/* zone_push -- puts chunk at the front of the arena's list of chunks with free granules */
+static void zone_push(zone_chunk_t *chunk) {
+    chunk->prev = NULL;
+    chunk->next = arena->zone_chunks;
+    if (arena->zone_chunks != NULL) {
+        arena->zone_chunks->prev = chunk;
+    }
+    arena->zone_chunks = chunk;
+}
+
+/* zone_unlink -- takes chunk off the arena's list of chunks with free granules */
+static void zone_unlink(zone_chunk_t *chunk) {
+    if (chunk->prev != NULL) {
+        chunk->prev->next = chunk->next;
+    } else {
+        arena->zone_chunks = chunk->next;
+    }
+    if (chunk->next != NULL) {
+        chunk->next->prev = chunk->prev;
+    }
+}
+#endif
 
-    ll_remove(bp); // remove bp from the linked list
+/* ptr_cmp -- orders payload pointers by address, for qsort */
+static int ptr_cmp(const void *a, const void *b) {
+    size_t x = (size_t) *(void * const *) a;
+    size_t y = (size_t) *(void * const *) b;
+    return (x > y) - (x < y);
 }
 
+/*
+ * size_class -- maps a block size to the index of the segregated list that holds it
+ * sizes up to SMALL_LIMIT get one list per 16 bytes, larger sizes one list per power of two
+ * the last list holds everything too large for the others
+ */
+static int size_class(size_t size) {
+    if (size <= MIN_LIST_SIZE) {
+        return 0;
+    }
+    if (size <= SMALL_LIMIT) {
+        return (size - MIN_LIST_SIZE) / DSIZE;
+    }
 
-/* ll_add -- add a free block to the linked list
+    int class = 63 - __builtin_clzl(size); // floor(log2(size)), 7 for the first size past SMALL_LIMIT
+    return (class < NUM_CLASSES) ? class : NUM_CLASSES - 1;
+}
+
+/* ll_add -- add a free block to the front of the free list of its size class
 * ARGUMENT: void* bp - pointer to the free block's payload
 * Returns nothing
-* PRECONDITION: this function assumes that the block *is* free but is not already in the linked list
+* PRECONDITION: this function assumes that the block *is* free but is not already in a free list
+* PRECONDITION: the header of bp holds the block's final size
+* blocks smaller than MIN_LIST_SIZE have no room for the links and are left out
 */
 static void ll_add(void* bp){
-    size_t* ll_start = (size_t*) PSUB(heap_start, DSIZE);
+    if (GET_SIZE(HDRP(bp)) < MIN_LIST_SIZE) {
+        return;
+    }
+    if (IN_TREE(GET_SIZE(HDRP(bp)))) {
+        tree_add(bp);
+        return;
+    }
+
+    size_t* ll_start = SEG_ROOT(size_class(GET_SIZE(HDRP(bp))));
     
     //second is the pointer to the first free block in the linked list which will soon become the second
     size_t* second = (size_t*) LL_NEXT(ll_start); 
@@ -283,15 +2040,24 @@ static void ll_add(void* bp){
     PUT(ll_start, (size_t) bp); // set update the pointer to the first item in the linked list
 }
 
-/* ll_remove -- remove a non-free block from the linked list
+/* ll_remove -- remove a block from the free list of its size class
 * ARGUMENT: void* bp - pointer to the block's payload
 * Returns nothing
-* PRECONDITION: this function assumes that the block *is not* free and should thus be removed from the list
+* PRECONDITION: this function assumes that the block is in a free list and should be removed from it
+* PRECONDITION: the header of bp still holds the size the block had when it was added
 */
 static void ll_remove(void* bp) {
-    size_t* ll_prev = (size_t*) LL_PREV((size_t) bp);       //find item before item to be removed
-    size_t* ll_next = (size_t*) LL_NEXT((size_t) bp);       //find item after to be removed
-    size_t* ll_start = (size_t*) PSUB(heap_start, DSIZE);   //find the start of the linked list
+    if (GET_SIZE(HDRP(bp)) < MIN_LIST_SIZE) { // never added, see ll_add
+        return;
+    }
+    if (IN_TREE(GET_SIZE(HDRP(bp)))) {
+        tree_remove(bp);
+        return;
+    }
+
+    size_t* ll_prev = (size_t*) LL_PREV((size_t) bp);                   //find item before item to be removed
+    size_t* ll_next = (size_t*) LL_NEXT((size_t) bp);                   //find item after to be removed
+    size_t* ll_start = SEG_ROOT(size_class(GET_SIZE(HDRP(bp))));        //find the start of the free list
     
     
     /* take out block from linked list */
@@ -308,79 +2074,170 @@ static void ll_remove(void* bp) {
     }
 }
 
+/*
+ * tree_add -- insert the free block bp into the best-fit tree: walk down to where
+ * bp's priority puts it, then split the subtree there into the blocks before and
+ * after bp, which become bp's children
+ * PRECONDITION: the header of bp holds the block's final size, which is at least TREE_MIN
+ */
+static void tree_add(void *bp) {
+    size_t *link = TREE_ROOT();
+    char *cur;
+
+    while ((cur = (char *) *link) != NULL && TREE_PRIO(cur) >= TREE_PRIO(bp)) {
+        link = TREE_LESS(bp, cur) ? PTR_LEFT(cur) : PTR_RIGHT(cur);
+    }
+
+    size_t *left = PTR_LEFT(bp);    // where the next block before bp is hung
+    size_t *right = PTR_RIGHT(bp);  // where the next block after bp is hung
+    while (cur != NULL) {
+        if (TREE_LESS(cur, bp)) {
+            *left = (size_t) cur;
+            left = PTR_RIGHT(cur);
+            cur = (char *) *left;
+        } else {
+            *right = (size_t) cur;
+            right = PTR_LEFT(cur);
+            cur = (char *) *right;
+        }
+    }
+    *left = 0;
+    *right = 0;
+    *link = (size_t) bp;
+}
+
+/*
+ * tree_remove -- take the free block bp out of the best-fit tree: find the link that 
+ * points to it and hang the merge of its two subtrees there
+ * PRECONDITION: bp is in the tree and its header still holds the size it was added with
+ */
+static void tree_remove(void *bp) {
+    size_t *link = TREE_ROOT();
+
+    while ((char *) *link != bp) {
+        link = TREE_LESS(bp, *link) ? PTR_LEFT(*link) : PTR_RIGHT(*link);
+    }
+
+    char *left = (char *) *PTR_LEFT(bp);
+    char *right = (char *) *PTR_RIGHT(bp);
+    while (left != NULL && right != NULL) {
+        if (TREE_PRIO(left) > TREE_PRIO(right)) {
+            *link = (size_t) left;
+            link = PTR_RIGHT(left);
+            left = (char *) *link;
+        } else {
+            *link = (size_t) right;
+            link = PTR_LEFT(right);
+            right = (char *) *link;
+        }
+    }
+    *link = (size_t) (left != NULL ? left : right);
+}
+
+/*
+ * tree_fit -- returns the smallest block in the best-fit tree with at least asize bytes
+ * (the lowest address among blocks of that size), or NULL if there is none
+ */
+static void *tree_fit(size_t asize) {
+    char *best = NULL;
+
+    for (char *cur = (char *) *TREE_ROOT(); cur != NULL; ) {
+        if (GET_SIZE(HDRP(cur)) >= asize) {
+            best = cur;
+            cur = (char *) *PTR_LEFT(cur);
+        } else {
+            cur = (char *) *PTR_RIGHT(cur);
+        }
+    }
+    return best;
+}
+
 /*
  * coalesce -- Boundary tag coalescing.
- * Takes a pointer to a free block
- * Return ptr to coalesced block
+ * Takes a pointer to a free block that is not yet in any free list
+ * Return ptr to coalesced block, which has been added to the free list of its size class
  * PRECONDITIONS: bp must point to a block that is already free
  */
 static void *coalesce(void *bp) {
-    void* prev = PREV_BLKP(bp); // Left neibor of newly freed block (on the heap)
-    void* next = NEXT_BLKP(bp); // Right neibor of newly freed block (on the heap)
-
-    void* previous_header = HDRP(prev);     // pointer to the previous header
+    void* next = NEXT_BLKP(bp);             // Right neibor of newly freed block (on the heap)
     void* next_header = HDRP(next);         // pointer to the next header
+    void* prev = NULL;                      // Left neibor of newly freed block, only looked up if it is free
+    void* previous_header = NULL;           // pointer to the previous header
 
     size_t totalsize; // will be updated to reflect the total size of all the neiboring free blocks 
 
-    if (!GET_ALLOC(previous_header) && !GET_ALLOC(next_header)) { // if both neibors are free
-        /* remove middle and next from the linked list */
-        ll_remove(bp);
+    if (!PREV_ALLOC(bp)) {
+        prev = PREV_BLKP(bp);
+        previous_header = HDRP(prev);
+    }
+
+    /* neighbors are removed from their lists before their size changes, since the 
+     * size decides which list they are in; the merged block is added back at the end */
+    if (prev && !GET_ALLOC(next_header)) { // if both neibors are free
+        ll_remove(prev);
         ll_remove(next);
 
         // size of: prev + middle + next
         totalsize = GET_SIZE(previous_header) + GET_SIZE(HDRP(bp)) + GET_SIZE(next_header); 
 
         //update header and footer
-        PUT(previous_header, totalsize); 
-        PUT(FTRP(prev), totalsize);
-
-        return prev;
+        set_free(prev, totalsize);
+        bp = prev;
 
-    } else if (!GET_ALLOC(previous_header)) { // if only the left is free
-        /* remove middle newly freed block from the linked list */
-        ll_remove(bp);
+    } else if (prev) { // if only the left is free
+        ll_remove(prev);
 
         totalsize = GET_SIZE(previous_header) + GET_SIZE(HDRP(bp)); // size of: prev + middle
 
         //update header and footer
-        PUT(previous_header, totalsize);
-        PUT(FTRP(prev), totalsize);
-
-        return prev;
+        set_free(prev, totalsize);
+        bp = prev;
 
     } else if (!GET_ALLOC(next_header)) { // if only the right is free
-        /* remove right block from the linked list */
         ll_remove(next);
 
         totalsize = GET_SIZE(HDRP(bp)) + GET_SIZE(next_header); // size of: middle + next
 
         //update header and footer
-        PUT(HDRP(bp), totalsize); 
-        PUT(FTRP(bp), totalsize); 
-        return bp;
+        set_free(bp, totalsize);
     }
 
-    // if neither neibor is free makes no change to the heap or linked list
+    // if neither neibor is free the block is added unchanged
+    ll_add(bp);
     return bp;
 }
 
 
 
-/* MODIFIED FOR LINKED LIST
+/* MODIFIED FOR SEGREGATED LISTS
  * find_fit - Find a fit for a block with asize bytes
- * exspects the linked list to be up to date
+ * exspects the free lists to be up to date
  * returns a pointer to a porperly sized block or nothing if no fit was found
  * takes in a goal payload size
+ *
+ * only the list of asize's own class is searched first fit; every block in a larger
+ * class is bigger than anything in asize's class, so the first one found there fits
+ * sizes kept in the best-fit tree are looked up there once the lists have nothing
  */
 static void *find_fit(size_t asize) {
-    for (char *cur_block = (char*) LL_NEXT(PSUB(heap_start, DSIZE)); (size_t) cur_block != (size_t) 0; 
-         cur_block = (char *) LL_NEXT(cur_block)) {
-        // heap_start is set to the blk ptr of the prologue, so we do (heap_start-16) to 
-        // get to the padding at the front
+    if (BEST_FIT_TREE) {
+        for (int class = size_class(asize); class < size_class(TREE_MIN); class++) {
+            for (char *cur_block = (char*) LL_NEXT(SEG_ROOT(class)); cur_block != NULL; 
+                 cur_block = (char *) LL_NEXT(cur_block)) {
+                if (asize <= GET_SIZE(HDRP(cur_block))) { 
+                    return cur_block;
+                }
+            }
+        }
+        return tree_fit(asize);
+    }
 
-        if (asize <= GET_SIZE(HDRP(cur_block))) { 
-            return cur_block;
+    for (int class = size_class(asize); class < NUM_CLASSES; class++) {
+        for (char *cur_block = (char*) LL_NEXT(SEG_ROOT(class)); (size_t) cur_block != (size_t) 0; 
+             cur_block = (char *) LL_NEXT(cur_block)) {
+            if (asize <= GET_SIZE(HDRP(cur_block))) { 
+                return cur_block;
+            }
         }
     }
     return NULL;  /* no fit found */
@@ -399,15 +2256,15 @@ static void *extend_heap(size_t words) {
     /* Allocate an even number of words to maintain alignment */
     if (words % 2 == 1)
         size += WSIZE;
-    if ((long)(bp = mem_sbrk(size)) < 0)
+    if ((long)(bp = mem_region_sbrk(arena->region, size)) < 0)
         return NULL;
 
-    PUT(HDRP(bp), PACK(size, 0));         /* free block header */
-    PUT(FTRP(bp), PACK(size, 0));         /* free block footer */
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* new epilogue header */
+    /* the old epilogue header becomes the free block header and keeps its prev-alloc bit */
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC_BIT(HDRP(bp))));  /* free block header */
+    PUT(FTRP(bp), PACK(size, 0));                             /* free block footer */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));                     /* new epilogue header */
     
-    ll_add(bp);             // add newly created block to the linked list 
-    return coalesce(bp);    // check if the end of the old heap is empty and can be coalesced
+    return coalesce(bp);    // merge with the end of the old heap if it is empty and add to a free list
 }
 
 
@@ -421,16 +2278,20 @@ static void *extend_heap(size_t words) {
 static bool check_heap(int line) {
     char *bp;
 
-    if ((GET_SIZE(HDRP(heap_start)) != DSIZE) || !GET_ALLOC(HDRP(heap_start))) {
+    if ((GET_SIZE(HDRP(arena->heap_start)) != DSIZE) || !GET_ALLOC(HDRP(arena->heap_start))) {
         printf("(check_heap at line %d) Error: bad prologue header\n", line);
         return false;
     }
 
-    for (bp = heap_start; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+    for (bp = arena->heap_start; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
         if (!check_block(line, bp)) {
             printf("in check_heap()\n");
             return false;
         }
+        if (FOOTERLESS && !GET_PREV_ALLOC_BIT(HDRP(NEXT_BLKP(bp))) != !GET_ALLOC(HDRP(bp))) {
+            printf("(check_heap at line %d) Error: prev-alloc bit after %p is wrong\n", line, bp);
+            return false;
+        }
     }
 
     if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp)))) {
@@ -441,28 +2302,70 @@ static bool check_heap(int line) {
     return true;
 }
 
-/* check_ll -- Performs the same as check heap on on the explicit free list's blocks */
+/* check_ll -- Performs the same as check heap on each segregated list's blocks
+ * and makes sure every block is free and filed under the right size class */
 static bool check_ll(int line) {
-    for (char *cur_block = (char*) LL_NEXT(PSUB(heap_start, DSIZE)); cur_block != 0; 
-         cur_block = (char *) LL_NEXT(cur_block)) {
-        if (!check_block(line, cur_block) && (GET_SIZE(cur_block) != 0)) {
-            printf("(check_ll at line %d) Error: bad block --> ", line);
-            print_block(cur_block);
-            return false;
+    if (BEST_FIT_TREE && !check_tree(line, (void *) *TREE_ROOT(), NULL, NULL)) {
+        return false;
+    }
+    for (int class = 0; class < (BEST_FIT_TREE ? size_class(TREE_MIN) : NUM_CLASSES); class++) {
+        for (char *cur_block = (char*) LL_NEXT(SEG_ROOT(class)); cur_block != 0; 
+             cur_block = (char *) LL_NEXT(cur_block)) {
+            if (!check_block(line, cur_block) && (GET_SIZE(cur_block) != 0)) {
+                printf("(check_ll at line %d) Error: bad block --> ", line);
+                print_block(cur_block);
+                return false;
+            }
+            if (GET_ALLOC(HDRP(cur_block)) || size_class(GET_SIZE(HDRP(cur_block))) != class) {
+                printf("(check_ll at line %d) Error: block in wrong list %d --> ", line, class);
+                print_block(cur_block);
+                return false;
+            }
         }
     } 
     return true;
 }
 
+/*
+ * check_tree -- Checks the subtree of the best-fit tree rooted at bp: every node is a 
+ * good free block big enough for the tree, the nodes are in (size, address) order 
+ * strictly between lo and hi (NULL for no bound), and no child has a higher priority
+ */
+static bool check_tree(int line, void *bp, void *lo, void *hi) {
+    if (bp == NULL) {
+        return true;
+    }
+    if (!check_block(line, bp) || GET_ALLOC(HDRP(bp)) || !IN_TREE(GET_SIZE(HDRP(bp)))) {
+        printf("(check_ll at line %d) Error: bad block in the tree --> ", line);
+        print_block(bp);
+        return false;
+    }
+    if ((lo != NULL && !TREE_LESS(lo, bp)) || (hi != NULL && !TREE_LESS(bp, hi))) {
+        printf("(check_ll at line %d) Error: tree out of order at %p\n", line, bp);
+        return false;
+    }
+
+    void *left = (void *) *PTR_LEFT(bp);
+    void *right = (void *) *PTR_RIGHT(bp);
+    if ((left != NULL && TREE_PRIO(left) > TREE_PRIO(bp)) || 
+        (right != NULL && TREE_PRIO(right) > TREE_PRIO(bp))) {
+        printf("(check_ll at line %d) Error: tree priority out of order at %p\n", line, bp);
+        return false;
+    }
+    return check_tree(line, left, lo, bp) && check_tree(line, right, bp, hi);
+}
+
 /*
  * check_block -- Checks a block for alignment and matching header and footer
+ * (in the FOOTERLESS layout only free blocks have a footer to match)
  */
 static bool check_block(int line, void *bp) {
     if ((size_t)bp % DSIZE) {
         printf("(check_heap at line %d) Error: %p is not double-word aligned\n", line, bp);
         return false;
     }
-    if (GET(HDRP(bp)) != GET(FTRP(bp))) {
+    if ((!FOOTERLESS || !GET_ALLOC(HDRP(bp))) && 
+        (GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp)) || GET_ALLOC(HDRP(bp)) != GET_ALLOC(FTRP(bp)))) {
         printf("(check_heap at line %d) Error: header does not match footer\n", line);
         printf("header: %ld  |  footer: %ld\n", GET(HDRP(bp)), GET(FTRP(bp)));
         return false;
@@ -470,15 +2373,25 @@ static bool check_block(int line, void *bp) {
     return true;
 }
 
+/*
+ * tree_count -- the number of blocks in the subtree of the best-fit tree rooted at bp
+ */
+static size_t tree_count(void *bp) {
+    if (bp == NULL) {
+        return 0;
+    }
+    return 1 + tree_count((void *) *PTR_LEFT(bp)) + tree_count((void *) *PTR_RIGHT(bp));
+}
+
 /*
  * print_heap -- Prints out the current state of the implicit free list
  */
 static void print_heap() {
     char *bp;
 
-    printf("Heap (%p):\n", heap_start);
+    printf("Heap (%p):\n", arena->heap_start);
 
-    for (bp = heap_start; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+    for (bp = arena->heap_start; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
         print_block(bp);
     }
 
@@ -500,6 +2413,10 @@ static void print_block(void *bp) {
         printf("%p: End of free list\n", bp);
         return;
     }
+    if (FOOTERLESS && halloc) {
+        printf("%p: header: [%ld:%c] (no footer)\n", bp, hsize, 'a');
+        return;
+    }
 
     printf("%p: header: [%ld:%c] footer: [%ld:%c]\n", bp,
        hsize, (halloc ? 'a' : 'f'),
@@ -511,4 +2428,11 @@ static void print_block(void *bp) {
  */
 static size_t max(size_t x, size_t y) {
     return (x > y) ? x : y;
-}
\ No newline at end of file
+}
+
+/*
+ * min: returns x if x < y, and y otherwise.
+ */
+static size_t min(size_t x, size_t y) {
+    return (x < y) ? x : y;
+}
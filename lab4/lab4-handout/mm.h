@@ -4,6 +4,37 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern int mm_malloc_batch(size_t size, void **ptrs, int n);
+extern void mm_free_batch(void **ptrs, int n);
+extern void *mm_memalign(size_t align, size_t size);
+extern void **mm_halloc(size_t size);
+extern void mm_hfree(void **handle);
+extern size_t mm_compact(void);
+extern int mm_thread_init (void);
+extern void mm_tcache_stats(size_t *lookups, size_t *hits);
+
+#define MM_HEAP_CLASSES 32  /* room for the free list size classes of mm.c */
+#define MM_HEAP_BUCKETS 40  /* free_hist[k] counts free blocks of 2^k to 2^(k+1)-1 bytes */
+
+/* The shape of the calling thread's heap at one moment, see mm_heap_snapshot */
+typedef struct {
+    size_t heap_bytes;       /* size of the heap, list roots, prologue and epilogue included */
+    size_t alloc_blocks;     /* allocated blocks, not counting the small-block cache */
+    size_t alloc_bytes;      /* ... their total size */
+    size_t header_bytes;     /* ... the part of that taken by headers (and footers) */
+    size_t cached_blocks;    /* blocks held by the small-block cache */
+    size_t cached_bytes;
+    size_t free_blocks;
+    size_t free_bytes;
+    size_t largest_free;
+    size_t free_hist[MM_HEAP_BUCKETS];
+    int num_classes;         /* free list size classes in use */
+    size_t list_len[MM_HEAP_CLASSES]; /* blocks on each free list */
+    size_t mapped_blocks;    /* large blocks with pages of their own */
+    size_t mapped_bytes;
+} mm_heap_t;
+
+extern void mm_heap_snapshot(mm_heap_t *snap);
 
 
 /* 
@@ -0,0 +1,518 @@
+/*
+ * mmtrace.c - Records the malloc/calloc/realloc/free calls of a real
+ * process as a trace file that mdriver can replay.
+ *
+ * Build it with "make mmtrace.so" and preload it into any program:
+ *
+ *     unix> MMTRACE_OUT=traces/proxy.rep LD_PRELOAD=./mmtrace.so ../../lab5/proxy 15213
+ *
+ * The trace is written when the process exits, to $MMTRACE_OUT or
+ * mmtrace.<pid>.rep. It has the usual header (suggested heap size, which
+ * is the peak of live payload bytes, number of ids, number of requests
+ * and weight) and one "a id size", "r id size" or "f id" line per request.
+ * Traces with "r" lines need mdriver-realloc.
+ *
+ * Every block gets an id from one atomic counter when it is allocated,
+ * and keeps it across reallocs. Each thread appends its requests, tagged
+ * with a global sequence number, to a ring of its own without taking any
+ * lock. A full ring goes to a spool file in one write(). At exit the
+ * spool is sorted by sequence number into the trace. Blocks that are
+ * still allocated then get a free at the end, so the trace is balanced
+ * like the default ones.
+ *
+ * Frees have to find the id of a payload address, from any thread, so
+ * that table is shared and kept under a lock. An address is removed from
+ * it before the block goes back to malloc and added after malloc returns
+ * it, so a block that is reused right away by another thread is never
+ * confused with the old one. Blocks from memalign and friends, malloc(0)
+ * and frees of unknown addresses are not recorded. Forked children stop
+ * recording.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RING_EVENTS (1 << 16) /* requests a thread buffers before spooling them */
+#define MIN_SLOTS   (1 << 16) /* smallest address table */
+#define BOOT_SIZE   4096      /* for dlsym's callocs, before the real calloc is known */
+#define SLOT_EMPTY   ((void *)0)
+#define SLOT_DELETED ((void *)1)
+
+/* thread-locals of a preloaded library must not need malloc to be set up */
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+/* One request, as it goes into the spool */
+typedef struct {
+    unsigned long seq;     /* global order of the request */
+    unsigned int id;       /* block id */
+    unsigned int size;     /* payload size (0 for frees) */
+    char type;             /* 'a', 'r' or 'f', as in the trace */
+} event_t;
+
+/* Per-thread request buffer; rings of exited threads are reused */
+typedef struct ring {
+    event_t events[RING_EVENTS];
+    int count;
+    int in_use;            /* owned by a live thread */
+    struct ring *next;     /* every ring, for the flush at exit */
+} ring_t;
+
+/* Entry of the address -> id table */
+typedef struct {
+    void *addr;
+    unsigned int id;
+} slot_t;
+
+/* The functions we wrap */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+static char boot_buf[BOOT_SIZE] __attribute__((aligned(16)));
+static size_t boot_used;
+static int booting;
+
+static int recording;           /* cleared at exit and in forked children */
+static pid_t owner_pid;
+static int spool_fd = -1;
+static char out_path[PATH_MAX];
+static char spool_path[PATH_MAX + 32];
+
+static unsigned long next_seq;  /* atomic */
+static unsigned int next_id;    /* atomic */
+static ring_t *rings;           /* list head, pushed with CAS */
+static pthread_key_t ring_key;
+
+static TLS ring_t *my_ring;
+static TLS int in_shim;         /* our own mallocs are not recorded */
+
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+static slot_t *map;
+static int map_bits;
+static unsigned long map_used;  /* live entries and tombstones */
+static unsigned long map_live;
+
+/*
+ * Helper functions
+ */
+
+static void init_real(void)
+{
+    booting = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    booting = 0;
+}
+
+/* boot_alloc - zeroed memory for dlsym, which may calloc before calloc exists */
+static void *boot_alloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~15UL;
+    if (boot_used + size > BOOT_SIZE)
+        return NULL;
+    p = boot_buf + boot_used;
+    boot_used += size;
+    return p;
+}
+
+static int is_boot(void *p)
+{
+    return (char *)p >= boot_buf && (char *)p < boot_buf + BOOT_SIZE;
+}
+
+static int tracing(void)
+{
+    return recording && !in_shim;
+}
+
+/* map_slot - the slot of addr, or the empty slot where it would go */
+static slot_t *map_slot(void *addr, slot_t **free_slot)
+{
+    unsigned long mask = (1UL << map_bits) - 1;
+    unsigned long i = (((unsigned long)addr >> 4) * 0x9E3779B97F4A7C15UL) >> (64 - map_bits);
+
+    *free_slot = NULL;
+    for (;; i = (i + 1) & mask) {
+        if (map[i].addr == addr || map[i].addr == SLOT_EMPTY)
+            return &map[i];
+        if (map[i].addr == SLOT_DELETED && *free_slot == NULL)
+            *free_slot = &map[i];
+    }
+}
+
+/* map_rehash - Move the live entries to a table with room for as many again */
+static void map_rehash(void)
+{
+    slot_t *old = map, *s, *free_slot;
+    unsigned long old_slots = old ? 1UL << map_bits : 0, i;
+    int bits = 16;
+
+    while ((1UL << bits) < MIN_SLOTS || (1UL << bits) < 4 * (map_live + 1))
+        bits++;
+    map = mmap(NULL, sizeof(slot_t) << bits, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "mmtrace: could not map the address table, stopping\n");
+        recording = 0;
+        map = old;
+        return;
+    }
+    map_bits = bits;
+    for (i = 0; i < old_slots; i++) {
+        if (old[i].addr != SLOT_EMPTY && old[i].addr != SLOT_DELETED) {
+            s = map_slot(old[i].addr, &free_slot);
+            *s = old[i];
+        }
+    }
+    map_used = map_live;
+    if (old != NULL)
+        munmap(old, old_slots * sizeof(slot_t));
+}
+
+/* map_put - Remember the id of the block at addr */
+static void map_put(void *addr, unsigned int id)
+{
+    slot_t *s, *free_slot;
+
+    pthread_mutex_lock(&map_lock);
+    if (map == NULL || 2 * (map_used + 1) > (1UL << map_bits))
+        map_rehash();
+    if (map != NULL) {
+        s = map_slot(addr, &free_slot);
+        if (s->addr != addr) { /* (an address we missed the free of is just overwritten) */
+            if (free_slot != NULL)
+                s = free_slot;
+            else
+                map_used++;
+            map_live++;
+        }
+        s->addr = addr;
+        s->id = id;
+    }
+    pthread_mutex_unlock(&map_lock);
+}
+
+/* map_take - Look up and forget the id of the block at addr; 0 if unknown */
+static int map_take(void *addr, unsigned int *id)
+{
+    slot_t *s, *free_slot;
+    int found = 0;
+
+    pthread_mutex_lock(&map_lock);
+    if (map != NULL) {
+        s = map_slot(addr, &free_slot);
+        if (s->addr == addr) {
+            *id = s->id;
+            s->addr = SLOT_DELETED;
+            map_live--;
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&map_lock);
+    return found;
+}
+
+static void flush_ring(ring_t *r)
+{
+    char *buf = (char *)r->events;
+    size_t left = r->count * sizeof(event_t);
+    ssize_t n;
+
+    /* O_APPEND makes each write land in one piece after the others */
+    while (left > 0 && (n = write(spool_fd, buf, left)) > 0) {
+        buf += n;
+        left -= n;
+    }
+    r->count = 0;
+}
+
+/* ring_release - Flush the ring of an exiting thread and let others reuse it */
+static void ring_release(void *arg)
+{
+    ring_t *r = arg;
+
+    in_shim++;
+    flush_ring(r);
+    my_ring = NULL;
+    __atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+    in_shim--;
+}
+
+/* thread_ring - The calling thread's ring: a released one, or a new one */
+static ring_t *thread_ring(void)
+{
+    ring_t *r;
+    int idle = 0;
+
+    if (my_ring != NULL)
+        return my_ring;
+    for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+        idle = 0;
+        if (__atomic_compare_exchange_n(&r->in_use, &idle, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (r == NULL) {
+        r = mmap(NULL, sizeof(ring_t), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (r == MAP_FAILED)
+            return NULL;
+        r->in_use = 1;
+        r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &r->next, r, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    my_ring = r;
+    pthread_setspecific(ring_key, r);
+    return r;
+}
+
+/* record - Append a request to the calling thread's ring */
+static void record(char type, unsigned int id, size_t size)
+{
+    ring_t *r;
+    event_t *e;
+
+    if ((r = thread_ring()) == NULL)
+        return;
+    e = &r->events[r->count];
+    e->seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    e->id = id;
+    e->size = size;
+    e->type = type;
+    if (++r->count == RING_EVENTS)
+        flush_ring(r);
+}
+
+/* note_alloc - Give the new block at p an id and record its allocation */
+static void note_alloc(void *p, size_t size)
+{
+    unsigned int id;
+
+    if (size == 0 || size > INT_MAX)
+        return;
+    in_shim++;
+    id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    map_put(p, id);
+    record('a', id, size);
+    in_shim--;
+}
+
+static void stop_child(void)
+{
+    recording = 0;
+}
+
+static int event_cmp(const void *a, const void *b)
+{
+    unsigned long x = ((const event_t *)a)->seq, y = ((const event_t *)b)->seq;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * write_trace - Sort the spooled requests and write them as a trace file
+ */
+static void write_trace(void)
+{
+    struct stat st;
+    event_t *ev;
+    size_t n, i;
+    unsigned int num_ids = 0, live = 0;
+    unsigned int *sizes;
+    char *alive;
+    long bytes = 0, peak = 0;
+    FILE *out;
+
+    if (fstat(spool_fd, &st) < 0 || (n = st.st_size / sizeof(event_t)) == 0)
+        return;
+    ev = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, spool_fd, 0);
+    if (ev == MAP_FAILED)
+        return;
+    qsort(ev, n, sizeof(event_t), event_cmp);
+
+    /* Replay the requests once to find the number of ids and the peak */
+    for (i = 0; i < n; i++)
+        if (ev[i].id >= num_ids)
+            num_ids = ev[i].id + 1;
+    sizes = real_calloc(num_ids, sizeof(unsigned int));
+    alive = real_calloc(num_ids, 1);
+    if (sizes == NULL || alive == NULL) {
+        fprintf(stderr, "mmtrace: out of memory writing %s\n", out_path);
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        bytes -= sizes[ev[i].id];
+        sizes[ev[i].id] = ev[i].size;
+        bytes += ev[i].size;
+        live += (ev[i].type == 'a') - (ev[i].type == 'f');
+        alive[ev[i].id] = (ev[i].type != 'f');
+        peak = (bytes > peak) ? bytes : peak;
+    }
+
+    if ((out = fopen(out_path, "w")) == NULL) {
+        fprintf(stderr, "mmtrace: could not open %s\n", out_path);
+        return;
+    }
+    fprintf(out, "%ld\n%u\n%lu\n1\n", peak < INT_MAX ? peak : INT_MAX,
+            num_ids, (unsigned long)(n + live));
+    for (i = 0; i < n; i++) {
+        if (ev[i].type == 'f')
+            fprintf(out, "f %u\n", ev[i].id);
+        else
+            fprintf(out, "%c %u %u\n", ev[i].type, ev[i].id, ev[i].size);
+    }
+    for (i = 0; i < num_ids; i++)
+        if (alive[i])
+            fprintf(out, "f %lu\n", (unsigned long)i);
+    fclose(out);
+    munmap(ev, st.st_size);
+    real_free(sizes);
+    real_free(alive);
+}
+
+__attribute__((constructor)) static void mmtrace_init(void)
+{
+    char *path = getenv("MMTRACE_OUT");
+
+    in_shim++;
+    if (real_malloc == NULL)
+        init_real();
+    owner_pid = getpid();
+    if (path != NULL && *path != '\0')
+        snprintf(out_path, sizeof(out_path), "%s", path);
+    else
+        snprintf(out_path, sizeof(out_path), "mmtrace.%d.rep", (int)owner_pid);
+    snprintf(spool_path, sizeof(spool_path), "%s.spool.%d", out_path, (int)owner_pid);
+    spool_fd = open(spool_path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (spool_fd < 0)
+        fprintf(stderr, "mmtrace: could not open %s, not recording\n", spool_path);
+    else if (pthread_key_create(&ring_key, ring_release) == 0 &&
+             pthread_atfork(NULL, NULL, stop_child) == 0)
+        recording = 1;
+    in_shim--;
+}
+
+__attribute__((destructor)) static void mmtrace_fini(void)
+{
+    ring_t *r;
+
+    if (!recording || getpid() != owner_pid)
+        return;
+    recording = 0;
+    in_shim++;
+    for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+        flush_ring(r);
+    write_trace();
+    close(spool_fd);
+    unlink(spool_path);
+    in_shim--;
+}
+
+/*
+ * The wrapped allocator functions
+ */
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL && !booting)
+        init_real();
+    if (booting)
+        return boot_alloc(size);
+    p = real_malloc(size);
+    if (p != NULL && tracing())
+        note_alloc(p, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (real_calloc == NULL && !booting)
+        init_real();
+    if (booting)
+        return (size != 0 && nmemb > SIZE_MAX / size) ? NULL : boot_alloc(nmemb * size);
+    p = real_calloc(nmemb, size);
+    if (p != NULL && tracing())
+        note_alloc(p, nmemb * size);
+    return p;
+}
+
+void free(void *ptr)
+{
+    unsigned int id;
+
+    if (ptr == NULL || is_boot(ptr))
+        return;
+    if (real_free == NULL)
+        init_real();
+    if (tracing()) {
+        in_shim++;
+        if (map_take(ptr, &id))
+            record('f', id, 0);
+        in_shim--;
+    }
+    real_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+    unsigned int id;
+    int known;
+
+    if (ptr != NULL && is_boot(ptr)) {
+        if ((p = malloc(size)) != NULL)
+            memcpy(p, ptr, size < (size_t)(boot_buf + BOOT_SIZE - (char *)ptr) ?
+                   size : (size_t)(boot_buf + BOOT_SIZE - (char *)ptr));
+        return p;
+    }
+    if (real_realloc == NULL)
+        init_real();
+    if (!tracing())
+        return real_realloc(ptr, size);
+    if (ptr == NULL)
+        return malloc(size);
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    in_shim++;
+    known = map_take(ptr, &id);
+    p = real_realloc(ptr, size);
+    if (!known) {
+        if (p != NULL) {
+            in_shim--;
+            note_alloc(p, size);
+            in_shim++;
+        }
+    } else if (p == NULL)
+        map_put(ptr, id);          /* the old block is still there */
+    else if (size > INT_MAX)
+        record('f', id, 0);
+    else {
+        map_put(p, id);
+        record('r', id, size);
+    }
+    in_shim--;
+    return p;
+}
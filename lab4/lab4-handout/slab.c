@@ -0,0 +1,295 @@
+/*
+ * slab.c - object caches for fixed-size objects, layered on mm.c.
+ *
+ * A cache hands out objects of one size. It gets its memory from mm_memalign in slabs
+ * that start at a multiple of SLAB_SIZE, so the slab of an object is found by clearing
+ * the low bits of its address. A slab is a header followed by as many objects as fit:
+ *
+ *   | cache | next | prev | nfree | hint | free map (1 bit per object) | obj 0 | obj 1 | ...
+ *
+ * A set bit in the free map marks a free object. slab_alloc takes the lowest set bit of
+ * the first slab on the cache's partial list (hint skips the words that are all zero, and
+ * there are at most SLAB_BYTES/16/64 = 4 words), and freeing sets the bit again, so both
+ * take constant time and never touch the objects themselves.
+ *
+ * In front of the slabs sits a magazine: a stack of up to SLAB_MAG objects freed last.
+ * slab_free pushes onto it and slab_alloc pops from it, without touching any slab header,
+ * so a free followed by an alloc (the common case for a queue node or a cache entry being
+ * replaced) costs two stack operations. A full magazine is emptied into the free maps.
+ *
+ * Every slab is on one of three lists: partial (some objects free), full (none free) and
+ * empty (all free). The cache keeps at most one empty slab, so a workload that keeps
+ * crossing a slab boundary does not create and release a slab every time; any other slab
+ * that becomes empty is given back to mm_free right away.
+ *
+ * A slab takes SLAB_BYTES rather than SLAB_SIZE bytes, which leaves room for the mm block
+ * header of the next slab: aligned slabs carved one after another sit back to back.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mm.h"
+#include "slab.h"
+
+#define SLAB_ALIGN   16                 /* alignment of every object */
+#define SLAB_BYTES   (SLAB_SIZE - 16)   /* usable bytes of a slab, see the top of the file */
+#define SLAB_MAG     32                 /* objects the magazine holds */
+
+/* Round n up to a multiple of SLAB_ALIGN */
+#define ALIGN_UP(n)  (((n) + SLAB_ALIGN - 1) & ~(size_t) (SLAB_ALIGN - 1))
+
+/* The header at the start of every slab */
+typedef struct slab {
+    slab_cache_t *cache;        // the cache the slab belongs to
+    struct slab *next;          // neighbors on the cache's partial or full list
+    struct slab *prev;
+    unsigned int nfree;         // number of free objects
+    unsigned int hint;          // no free map word below this one has a set bit
+    uint64_t free_map[];        // bit i is set if object i is free
+} slab_t;
+
+struct slab_cache {
+    size_t obj_size;            // object size, a multiple of SLAB_ALIGN
+    size_t obj_offset;          // offset of object 0 from the start of its slab
+    uint64_t recip;             // 2^32 / obj_size rounded up, to divide offsets by obj_size
+    unsigned int objs_per_slab;
+    unsigned int map_words;     // free map words of each slab
+    slab_t *partial;            // slabs with free and used objects
+    slab_t *full;               // slabs without free objects
+    slab_t *empty;              // at most one slab without used objects
+    int mag_count;              // objects in the magazine
+    void *mag[SLAB_MAG];        // the objects freed last, still marked used in their slabs
+    size_t slabs;
+    size_t live_objs;
+    size_t slabs_created;
+    size_t slabs_released;
+};
+
+static void *slab_take(slab_cache_t *cache);
+static void slab_put(slab_cache_t *cache, void *obj);
+static slab_t *slab_new(slab_cache_t *cache);
+static void slab_push(slab_t **list, slab_t *slab);
+static void slab_unlink(slab_t **list, slab_t *slab);
+static void slab_free_list(slab_t *slab);
+
+
+/*
+ * slab_cache_create -- creates a cache for objects of obj_size bytes (at most SLAB_MAX_OBJ)
+ * the cache record itself comes from mm_malloc; no slab is allocated until the first object
+ * Returns the cache, or NULL
+ */
+slab_cache_t *slab_cache_create(size_t obj_size) {
+    slab_cache_t *cache;
+    size_t n;
+
+    if (obj_size == 0 || obj_size > SLAB_MAX_OBJ) {
+        return NULL;
+    }
+    if ((cache = mm_malloc(sizeof(slab_cache_t))) == NULL) {
+        return NULL;
+    }
+
+    cache->obj_size = ALIGN_UP(obj_size);
+
+    /* as many objects as fit behind a header with a free map bit for each of them */
+    n = SLAB_BYTES / cache->obj_size;
+    while (ALIGN_UP(offsetof(slab_t, free_map) + (n + 63) / 64 * sizeof(uint64_t)) +
+           n * cache->obj_size > SLAB_BYTES) {
+        n--;
+    }
+    cache->objs_per_slab = n;
+    cache->map_words = (n + 63) / 64;
+    cache->obj_offset = ALIGN_UP(offsetof(slab_t, free_map) + cache->map_words * sizeof(uint64_t));
+
+    /* offset * recip >> 32 is offset / obj_size for every offset in a slab */
+    cache->recip = ((uint64_t) 1 << 32) / cache->obj_size + 1;
+
+    cache->partial = NULL;
+    cache->full = NULL;
+    cache->empty = NULL;
+    cache->mag_count = 0;
+    cache->slabs = 0;
+    cache->live_objs = 0;
+    cache->slabs_created = 0;
+    cache->slabs_released = 0;
+    return cache;
+}
+
+/*
+ * slab_cache_destroy -- gives every slab of the cache and the cache itself back to mm_free
+ * objects still in use are freed with their slabs
+ */
+void slab_cache_destroy(slab_cache_t *cache) {
+    slab_free_list(cache->partial);
+    slab_free_list(cache->full);
+    if (cache->empty != NULL) {
+        mm_free(cache->empty);
+    }
+    mm_free(cache);
+}
+
+/*
+ * slab_alloc -- hands out a free object of the cache, the one freed last if the magazine
+ * has any, else one from a slab
+ * Returns the object (16-byte aligned), or NULL if mm is out of memory
+ */
+void *slab_alloc(slab_cache_t *cache) {
+    if (cache->mag_count > 0) {
+        cache->live_objs++;
+        return cache->mag[--cache->mag_count];
+    }
+    return slab_take(cache);
+}
+
+/*
+ * slab_free -- gives the object obj back to the cache: onto the magazine, which is first
+ * emptied into the slabs if it is full
+ * PRECONDITION: obj was returned by slab_alloc on this cache and has not been freed since
+ */
+void slab_free(slab_cache_t *cache, void *obj) {
+    if (cache->mag_count == SLAB_MAG) {
+        while (cache->mag_count > 0) {
+            slab_put(cache, cache->mag[--cache->mag_count]);
+        }
+    }
+    cache->mag[cache->mag_count++] = obj;
+    cache->live_objs--;
+}
+
+/*
+ * slab_cache_stats -- fills in stats with the object size, slab counts and live objects
+ * of the cache
+ */
+void slab_cache_stats(slab_cache_t *cache, slab_stats_t *stats) {
+    stats->obj_size = cache->obj_size;
+    stats->objs_per_slab = cache->objs_per_slab;
+    stats->slabs = cache->slabs;
+    stats->live_objs = cache->live_objs;
+    stats->slabs_created = cache->slabs_created;
+    stats->slabs_released = cache->slabs_released;
+}
+
+
+/*
+ * slab_take -- takes a free object out of the first partial slab, else out of the empty
+ * slab, else out of a new slab
+ * Returns the object, or NULL if mm is out of memory
+ */
+static void *slab_take(slab_cache_t *cache) {
+    slab_t *slab = cache->partial;
+    unsigned int word, index;
+
+    if (slab == NULL) {
+        if ((slab = cache->empty) != NULL) {
+            cache->empty = NULL;
+        } else if ((slab = slab_new(cache)) == NULL) {
+            return NULL;
+        }
+        slab_push(&cache->partial, slab);
+    }
+
+    while (slab->free_map[slab->hint] == 0) {
+        slab->hint++;
+    }
+    word = slab->hint;
+    index = word * 64 + __builtin_ctzll(slab->free_map[word]);
+    slab->free_map[word] &= slab->free_map[word] - 1;   // clear the lowest set bit
+
+    if (--slab->nfree == 0) {
+        slab_unlink(&cache->partial, slab);
+        slab_push(&cache->full, slab);
+    }
+    cache->live_objs++;
+    return (char *) slab + cache->obj_offset + index * cache->obj_size;
+}
+
+/*
+ * slab_put -- marks the object obj free in its slab
+ * a slab that has no used objects left becomes the cache's empty slab, or goes back to
+ * mm_free if the cache already has one
+ */
+static void slab_put(slab_cache_t *cache, void *obj) {
+    slab_t *slab = (slab_t *) ((size_t) obj & ~(size_t) (SLAB_SIZE - 1));
+    uint64_t offset = (char *) obj - (char *) slab - cache->obj_offset;
+    unsigned int index = (offset * cache->recip) >> 32;
+    unsigned int word = index / 64;
+
+    slab->free_map[word] |= (uint64_t) 1 << (index % 64);
+    if (word < slab->hint) {
+        slab->hint = word;
+    }
+
+    if (slab->nfree++ == 0) {
+        slab_unlink(&cache->full, slab);
+        slab_push(&cache->partial, slab);
+    }
+    if (slab->nfree == cache->objs_per_slab) {
+        slab_unlink(&cache->partial, slab);
+        if (cache->empty == NULL) {
+            cache->empty = slab;
+        } else {
+            mm_free(slab);
+            cache->slabs--;
+            cache->slabs_released++;
+        }
+    }
+}
+
+/*
+ * slab_new -- gets a slab for the cache from mm_memalign, with every object free
+ * Returns the slab (on no list yet), or NULL
+ */
+static slab_t *slab_new(slab_cache_t *cache) {
+    slab_t *slab;
+    unsigned int word;
+    unsigned int n = cache->objs_per_slab;
+
+    if ((slab = mm_memalign(SLAB_SIZE, SLAB_BYTES)) == NULL) {
+        return NULL;
+    }
+
+    slab->cache = cache;
+    slab->nfree = n;
+    slab->hint = 0;
+    for (word = 0; word < cache->map_words; word++) {
+        slab->free_map[word] = (n >= 64 * (word + 1)) ? ~(uint64_t) 0 :
+                               ((uint64_t) 1 << (n % 64)) - 1;
+    }
+
+    cache->slabs++;
+    cache->slabs_created++;
+    return slab;
+}
+
+/* slab_push -- puts slab at the front of a partial or full list */
+static void slab_push(slab_t **list, slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list != NULL) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+/* slab_unlink -- takes slab off the list it is on */
+static void slab_unlink(slab_t **list, slab_t *slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/* slab_free_list -- gives every slab on a list back to mm_free */
+static void slab_free_list(slab_t *slab) {
+    while (slab != NULL) {
+        slab_t *next = slab->next;
+        mm_free(slab);
+        slab = next;
+    }
+}
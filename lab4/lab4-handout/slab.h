@@ -0,0 +1,28 @@
+#include <stdio.h>
+
+/*
+ * Object caches for fixed-size objects, on top of mm.c. A cache hands out
+ * objects of one size from slabs of SLAB_SIZE bytes it gets from mm_memalign.
+ * A cache is not thread-safe: only one thread may use it at a time.
+ */
+
+#define SLAB_SIZE     4096  /* bytes per slab, which is also the alignment of a slab */
+#define SLAB_MAX_OBJ  512   /* largest object size a cache takes */
+
+typedef struct slab_cache slab_cache_t;
+
+/* Statistics of one cache, see slab_cache_stats */
+typedef struct {
+    size_t obj_size;         /* object size, rounded up to 16 bytes */
+    size_t objs_per_slab;
+    size_t slabs;            /* slabs currently held, the empty one included */
+    size_t live_objs;        /* objects handed out and not freed */
+    size_t slabs_created;    /* slabs ever taken from mm_memalign ... */
+    size_t slabs_released;   /* ... and given back with mm_free */
+} slab_stats_t;
+
+extern slab_cache_t *slab_cache_create(size_t obj_size);
+extern void slab_cache_destroy(slab_cache_t *cache);
+extern void *slab_alloc(slab_cache_t *cache);
+extern void slab_free(slab_cache_t *cache, void *obj);
+extern void slab_cache_stats(slab_cache_t *cache, slab_stats_t *stats);
@@ -0,0 +1,193 @@
+/*
+ * slabbench.c - compares the slab object caches of slab.c with plain
+ *     mm_malloc/mm_free for 16, 32 and 64-byte objects.
+ *
+ * Every object size runs two workloads, both with mm_malloc/mm_free and
+ * with slab_alloc/slab_free on the simulated heap of memlib.c:
+ *
+ *   fill   allocate NUM_OBJS objects, then free them all, oldest first
+ *          (building a long queue and freeing it)
+ *   churn  keep CHURN_LIVE objects live and CHURN_OPS times free a
+ *          random one and allocate a new one in its place
+ *
+ * Throughput is timed by fsecs like in mdriver; util is the peak payload
+ * over the peak heap size.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "slab.h"
+#include "memlib.h"
+#include "fsecs.h"
+#include "config.h"
+
+#define NUM_OBJS    100000  /* objects of the fill workload */
+#define CHURN_LIVE  10000   /* live objects of the churn workload */
+#define CHURN_OPS   200000  /* frees (and as many allocs) of the churn workload */
+
+/* The parameters of one timed run, passed through fsecs */
+typedef struct {
+    size_t size;            /* object size */
+    int use_slab;           /* slab_alloc/slab_free rather than mm_malloc/mm_free */
+    void **objs;            /* the live objects */
+    int *victims;           /* for churn: the slot freed and refilled by each op */
+    slab_stats_t stats;     /* the slab cache at the end of the last run */
+} bench_t;
+
+static void run_fill(void *ptr);
+static void run_churn(void *ptr);
+static void *obj_alloc(bench_t *b, slab_cache_t *cache);
+static void obj_free(bench_t *b, slab_cache_t *cache, void *obj);
+static void report(char *name, fsecs_test_funct f, bench_t *b, double ops, size_t payload);
+static void usage(void);
+
+int verbose = 0;        /* global flag for verbose output (fsecs reads it too) */
+
+int main(int argc, char **argv)
+{
+    static const size_t sizes[] = {16, 32, 64};
+    bench_t b;
+    char c;
+    int i, s;
+
+    while ((c = getopt(argc, argv, "hv")) != EOF) {
+        switch (c) {
+        case 'v': /* Print slab statistics too */
+            verbose = 1;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    if ((b.objs = malloc(NUM_OBJS * sizeof(void *))) == NULL ||
+        (b.victims = malloc(CHURN_OPS * sizeof(int))) == NULL) {
+        fprintf(stderr, "malloc failed in main\n");
+        exit(1);
+    }
+    srand(208);
+    for (i = 0; i < CHURN_OPS; i++)
+        b.victims[i] = rand() % CHURN_LIVE;
+
+    mem_init();
+    init_fsecs();
+
+    printf("%5s %6s %5s %10s %8s %5s\n", "size", "test", "alloc", "ops", "Kops", "util");
+    for (s = 0; s < (int) (sizeof(sizes) / sizeof(sizes[0])); s++) {
+        b.size = sizes[s];
+        for (b.use_slab = 0; b.use_slab <= 1; b.use_slab++)
+            report("fill", run_fill, &b, 2.0 * NUM_OBJS, NUM_OBJS * b.size);
+        for (b.use_slab = 0; b.use_slab <= 1; b.use_slab++)
+            report("churn", run_churn, &b, 2.0 * CHURN_OPS + CHURN_LIVE, CHURN_LIVE * b.size);
+    }
+
+    mem_deinit();
+    free(b.objs);
+    free(b.victims);
+    exit(0);
+}
+
+/*
+ * run_fill - Allocate NUM_OBJS objects and free them in the same order
+ */
+static void run_fill(void *ptr)
+{
+    bench_t *b = (bench_t *) ptr;
+    slab_cache_t *cache = NULL;
+    int i;
+
+    mem_reset_brk();
+    if (mm_init() < 0 || (b->use_slab && (cache = slab_cache_create(b->size)) == NULL)) {
+        fprintf(stderr, "mm_init failed in run_fill\n");
+        exit(1);
+    }
+
+    for (i = 0; i < NUM_OBJS; i++)
+        b->objs[i] = obj_alloc(b, cache);
+    for (i = 0; i < NUM_OBJS; i++)
+        obj_free(b, cache, b->objs[i]);
+    if (cache)
+        slab_cache_stats(cache, &b->stats);
+}
+
+/*
+ * run_churn - Allocate CHURN_LIVE objects, then replace one picked at
+ *     random CHURN_OPS times
+ */
+static void run_churn(void *ptr)
+{
+    bench_t *b = (bench_t *) ptr;
+    slab_cache_t *cache = NULL;
+    int i;
+
+    mem_reset_brk();
+    if (mm_init() < 0 || (b->use_slab && (cache = slab_cache_create(b->size)) == NULL)) {
+        fprintf(stderr, "mm_init failed in run_churn\n");
+        exit(1);
+    }
+
+    for (i = 0; i < CHURN_LIVE; i++)
+        b->objs[i] = obj_alloc(b, cache);
+    for (i = 0; i < CHURN_OPS; i++) {
+        obj_free(b, cache, b->objs[b->victims[i]]);
+        b->objs[b->victims[i]] = obj_alloc(b, cache);
+    }
+    if (cache)
+        slab_cache_stats(cache, &b->stats);
+}
+
+/*
+ * obj_alloc - Allocate an object of b->size bytes one way or the other
+ */
+static void *obj_alloc(bench_t *b, slab_cache_t *cache)
+{
+    void *p = b->use_slab ? slab_alloc(cache) : mm_malloc(b->size);
+
+    if (p == NULL) {
+        fprintf(stderr, "out of memory in obj_alloc\n");
+        exit(1);
+    }
+    return p;
+}
+
+/*
+ * obj_free - Free an object of obj_alloc
+ */
+static void obj_free(bench_t *b, slab_cache_t *cache, void *obj)
+{
+    if (b->use_slab)
+        slab_free(cache, obj);
+    else
+        mm_free(obj);
+}
+
+/*
+ * report - Time f on b and print a line of results; payload is the most
+ *     bytes of objects live at once
+ */
+static void report(char *name, fsecs_test_funct f, bench_t *b, double ops, size_t payload)
+{
+    double secs = fsecs(f, b);
+
+    printf("%5zu %6s %5s %10.0f %8.0f %4.0f%%\n", b->size, name, b->use_slab ? "slab" : "mm",
+           ops, (ops / 1e3) / secs, 100.0 * payload / mem_heap_peak());
+    if (verbose && b->use_slab)
+        printf("%29s %zu objs per slab, %zu slabs, %zu created, %zu released\n", "",
+               b->stats.objs_per_slab, b->stats.slabs, b->stats.slabs_created,
+               b->stats.slabs_released);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: slabbench [-hv]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-v         Print the slab counts of every slab run.\n");
+}
@@ -0,0 +1,382 @@
+/**
+ * @file cache.c
+ *
+ * the web object cache of the proxy
+ *
+ * The cache is split into CACHE_SHARDS shards, picked by the top bits of the
+ * FNV-1a hash of the url, and every shard has its own reader-writer lock. A hit
+ * only takes the read lock of its shard, so hits on the same shard run side by
+ * side and hits on different shards never touch the same lock.
+ *
+ * Inside a shard the objects sit in a hash table (chained through hnext, indexed
+ * by the low bits of the hash) and on a ring (prev/next) that the CLOCK hand of
+ * the shard walks around. A hit cannot move its object to the front of an LRU
+ * list while holding only the read lock, so instead it sets the object's
+ * referenced bit. Eviction is second chance: the hand clears the bits it passes
+ * and evicts the first object whose bit was already clear. New objects go just
+ * behind the hand, so they are the last ones it reaches.
+ *
+ * Entries are cache objects (see cache.h): single allocations that never change
+ * once they are added, with a reference count. The cache holds one reference to
+ * every object in it, and a hit takes another one under the read lock, so the
+ * object outlives its eviction until the last reader calls cache_release. A hit
+ * therefore copies nothing; the proxy writes header and content to the client
+ * straight from the object.
+ *
+ * MAX_CACHE_SIZE holds for the cache as a whole. total_size is updated atomically,
+ * and an insertion that takes it over the budget evicts objects one at a time, so
+ * no thread ever holds two shard locks. Each one comes from the shard that holds the
+ * most bytes, which keeps the shards about equally full, so the CLOCK of every shard
+ * sees its share of the whole cache and together they approximate one LRU over it.
+ * The object just added is never the victim, and its shard only gives one up when
+ * no other shard has any.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "cache.h"
+
+size_t MAX_CACHE_SIZE = 1049000;
+size_t CACHE_BUCKETS = 64;       //initial number of hash buckets per shard, always a power of 2
+
+
+/* one independently locked part of the cache, on a cache line of its own */
+typedef struct {
+    pthread_rwlock_t lock;
+    cache_obj_t **buckets;
+    size_t nbuckets;
+    size_t count;       //number of objects
+    size_t bytes;       //bytes of its objects, only changed atomically (under the write lock) so eviction may peek
+    cache_obj_t *hand; //next object the CLOCK hand looks at, NULL if the shard is empty
+} __attribute__((aligned(64))) shard_t;
+
+
+/* Global Variables */
+static shard_t shards[CACHE_SHARDS];
+static size_t total_size;     //units is bytes, only changed atomically
+static unsigned int evict_next; //shard the next search for a victim starts at, so ties rotate
+
+
+/* FNV-1a hash of a url
+ * ARGUMENT: char* url - the string to hash
+ * RETURN: the 32 bit hash
+ */
+static unsigned int cache_hash(char *url) {
+    unsigned int hash = 2166136261u;
+    while (*url) {
+        hash ^= (unsigned char) *url++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* the shard a hash belongs to, from its top bits (the bucket index uses the low ones) */
+static shard_t* shard_of(unsigned int hash) {
+    return &shards[(unsigned long) hash >> (32 - CACHE_SHARD_BITS)];
+}
+
+/* put an object on the CLOCK ring of its shard just behind the hand */
+static void ring_insert(shard_t *shard, cache_obj_t *object) {
+    if (!shard->hand) {
+        object->prev = object->next = object;
+        shard->hand = object;
+        return;
+    }
+    object->next = shard->hand;
+    object->prev = shard->hand->prev;
+    object->prev->next = object;
+    shard->hand->prev = object;
+}
+
+/* take an object out of its shard completely (its bucket and the ring) and drop
+ * the reference of the cache, which frees it unless a reader still holds it
+ * PRECONDITION: the write lock of the shard is held
+ */
+static void shard_remove(shard_t *shard, cache_obj_t *object) {
+    cache_obj_t **link = &shard->buckets[object->hash & (shard->nbuckets - 1)];
+    while (*link != object) {
+        link = &(*link)->hnext;
+    }
+    *link = object->hnext;
+
+    if (object->next == object) {
+        shard->hand = NULL;
+    } else {
+        object->prev->next = object->next;
+        object->next->prev = object->prev;
+        if (shard->hand == object) {
+            shard->hand = object->next;
+        }
+    }
+    shard->count--;
+    __atomic_sub_fetch(&shard->bytes, object->bytes, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&total_size, object->bytes, __ATOMIC_RELAXED);
+    cache_release(object);
+}
+
+/* double the number of hash buckets of a shard, so the chains stay about one object long
+ * if there is no memory for the bigger table the old one is kept, which is only slower
+ * PRECONDITION: the write lock of the shard is held
+ */
+static void shard_grow(shard_t *shard) {
+    size_t nbuckets = shard->nbuckets * 2;
+    cache_obj_t **buckets = (cache_obj_t**) calloc(nbuckets, sizeof(cache_obj_t*));
+    if (!buckets) {
+        return;
+    }
+    for (size_t i = 0; i < shard->nbuckets; i++) {
+        cache_obj_t *cur = shard->buckets[i];
+        while (cur) {
+            cache_obj_t *next = cur->hnext;
+            size_t j = cur->hash & (nbuckets - 1);
+            cur->hnext = buckets[j];
+            buckets[j] = cur;
+            cur = next;
+        }
+    }
+    free(shard->buckets);
+    shard->buckets = buckets;
+    shard->nbuckets = nbuckets;
+}
+
+/* find the object for a url in its shard, without changing anything
+ * RETURN: the object, or NULL
+ * PRECONDITION: a lock of the shard is held
+ */
+static cache_obj_t* shard_find(shard_t *shard, unsigned int hash, char *url) {
+    cache_obj_t *cur = shard->buckets[hash & (shard->nbuckets - 1)];
+    while (cur) {
+        if (cur->hash == hash && strcmp(cur->url, url) == 0) {
+            return cur;
+        }
+        cur = cur->hnext;
+    }
+    return NULL;
+}
+
+/* the shard with the most bytes, other than home unless no other shard has any
+ * the byte counts are read without locks, so the answer may be slightly stale
+ * RETURN: the shard, or NULL if every shard is empty
+ */
+static shard_t* evict_pick(shard_t *home) {
+    unsigned int start = __atomic_fetch_add(&evict_next, 1, __ATOMIC_RELAXED);
+    shard_t *best = NULL;
+    size_t best_bytes = 0;
+
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        shard_t *shard = &shards[(start + i) % CACHE_SHARDS];
+        size_t bytes = __atomic_load_n(&shard->bytes, __ATOMIC_RELAXED);
+        if (shard != home && bytes > best_bytes) {
+            best = shard;
+            best_bytes = bytes;
+        }
+    }
+    if (!best && __atomic_load_n(&home->bytes, __ATOMIC_RELAXED) > 0) {
+        best = home;
+    }
+    return best;
+}
+
+/* evict one object from the fullest shard (see evict_pick), never keep itself
+ * the hand of that shard gives every referenced object it passes a second chance
+ * ARGUMENTS:
+            * shard_t* home - the shard just inserted into, the last choice
+            * cache_obj_t* keep - the object just added; only its address is compared,
+              since another thread may have evicted (and freed) it meanwhile
+ * RETURN: false if no object but keep was left to evict
+ * CRITICAL SECTIONS: write lock of the shard evicted from
+ */
+static int cache_evict_one(shard_t *home, cache_obj_t *keep) {
+    for (int tries = 0; tries < CACHE_SHARDS; tries++) {
+        shard_t *shard = evict_pick(home);
+        if (!shard) {
+            return 0;
+        }
+
+        pthread_rwlock_wrlock(&shard->lock);
+        // if keep left the ring meanwhile, skipping its address costs nothing
+        if (shard->hand && (shard->count > 1 || shard->hand != keep)) {
+            cache_obj_t *victim = shard->hand;
+            while (victim == keep || __atomic_exchange_n(&victim->referenced, 0, __ATOMIC_RELAXED)) {
+                victim = victim->next;
+            }
+            shard->hand = victim->next;
+            shard_remove(shard, victim);
+            pthread_rwlock_unlock(&shard->lock);
+            return 1;
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+    return 0;
+}
+
+
+/* print out the contents of the cache, shard by shard */
+void cache_print() {
+    printf("current cache: (%zd bytes)\n", __atomic_load_n(&total_size, __ATOMIC_RELAXED));
+    for (int s = 0; s < CACHE_SHARDS; s++) {
+        pthread_rwlock_rdlock(&shards[s].lock);
+        cache_obj_t *cur = shards[s].hand;
+        for (size_t i = 0; i < shards[s].count; i++, cur = cur->next) {
+            printf("[%d] %s (%zd)\n", s, cur->url, cur->size);
+        }
+        pthread_rwlock_unlock(&shards[s].lock);
+    }
+}
+
+/* initialize every shard of the cache
+ * No arguments, no return, no critical sections, called at the start of main
+*/
+void cache_init() {
+    for (int s = 0; s < CACHE_SHARDS; s++) {
+        pthread_rwlock_init(&shards[s].lock, NULL);
+        shards[s].nbuckets = CACHE_BUCKETS;
+        shards[s].buckets = (cache_obj_t**) calloc(CACHE_BUCKETS, sizeof(cache_obj_t*));
+        shards[s].count = 0;
+        shards[s].bytes = 0;
+        shards[s].hand = NULL;
+    }
+    total_size = 0;
+    evict_next = 0;
+}
+
+/* deallocate the entire cache (all the objects of every shard)
+ * No arguments, no return, no critical sections, called at the end of main
+ */
+void cache_free() {
+    for (int s = 0; s < CACHE_SHARDS; s++) {
+        while (shards[s].hand) {
+            shard_remove(&shards[s], shards[s].hand);
+        }
+        free(shards[s].buckets);
+        pthread_rwlock_destroy(&shards[s].lock);
+    }
+}
+
+/* search cache for an object with a matching url, mark it as referenced and pin it
+ * only the objects that share its hash bucket are compared, so this takes the same
+ * time however many objects the cache holds
+ * ARGUMENT: char* url - string that contains the url of the item to look up
+ * RETURN:
+         * the object if found, which stays valid (even if it is evicted) until
+           the caller gives it back with cache_release
+         * NULL if no matching object is found
+ * CRITICAL SECTIONS: read lock of the url's shard
+*/
+cache_obj_t* cache_lookup(char *url) {
+    unsigned int hash = cache_hash(url);
+    shard_t *shard = shard_of(hash);
+
+    pthread_rwlock_rdlock(&shard->lock);
+    cache_obj_t *object = shard_find(shard, hash, url);
+    if (object) {
+        // only store when the bit is clear, so hot objects do not bounce between cores
+        if (!__atomic_load_n(&object->referenced, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&object->referenced, 1, __ATOMIC_RELAXED);
+        }
+        __atomic_add_fetch(&object->refcount, 1, __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return object;
+}
+
+/* give back a reference to an object, and free the object if it was the last one
+ * ARGUMENT: cache_obj_t* obj - from cache_lookup or cache_obj_new
+ */
+void cache_release(cache_obj_t *obj) {
+    if (__atomic_sub_fetch(&obj->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(obj);
+    }
+}
+
+/* make an object that is not in the cache yet, in a single allocation
+ * the url and header are copied in, the content is left for the caller to fill in
+ * (for instance straight from the origin server) before cache_add
+ * ARGUMENTS:
+            * char* url - the full url of the item. This includes the port.
+            * char* header - the plaintext header of the requested file (content size, type, etc.)
+            * size_t size - size of the file (not including the header's size)
+ * RETURN: the object, holding one reference for the caller, or NULL if out of memory
+ */
+cache_obj_t* cache_obj_new(char *url, char *header, size_t size) {
+    size_t url_len = strlen(url)+1;
+    size_t header_len = strlen(header);
+    size_t bytes = sizeof(cache_obj_t) + header_len + size + url_len;
+    cache_obj_t *obj = (cache_obj_t*) malloc(bytes);
+    if (!obj) {
+        return NULL;
+    }
+
+    obj->header = (char*) (obj + 1);
+    obj->header_len = header_len;
+    memcpy(obj->header, header, header_len);
+    obj->content = obj->header + header_len;
+    obj->size = size;
+    obj->url = obj->content + size;
+    memcpy(obj->url, url, url_len);
+
+    obj->hash = cache_hash(url);
+    obj->referenced = 0;
+    obj->refcount = 1;
+    obj->bytes = bytes;
+    return obj;
+}
+
+/* insert a new object into the shard of its url
+ * an older object for the same url is replaced, and objects are evicted until the
+ * cache is back within MAX_CACHE_SIZE
+ * ARGUMENT: cache_obj_t* obj - from cache_obj_new, with its content filled in;
+ *           the caller's reference passes to the cache, so obj must not be used after
+ * CRITICAL SECTIONS: write lock of the url's shard, then of every shard evicted from
+ */
+void cache_add(cache_obj_t *obj) {
+    // an object that could never fit is not worth keeping
+    if (obj->bytes > MAX_CACHE_SIZE) {
+        cache_release(obj);
+        return;
+    }
+
+    shard_t *shard = shard_of(obj->hash);
+    pthread_rwlock_wrlock(&shard->lock);
+
+    // another thread may have cached the same url in the meantime
+    cache_obj_t *old = shard_find(shard, obj->hash, obj->url);
+    if (old) {
+        shard_remove(shard, old);
+    }
+
+    size_t i = obj->hash & (shard->nbuckets - 1);
+    obj->hnext = shard->buckets[i];
+    shard->buckets[i] = obj;
+    ring_insert(shard, obj);
+    if (++shard->count > shard->nbuckets) {
+        shard_grow(shard);
+    }
+    __atomic_add_fetch(&shard->bytes, obj->bytes, __ATOMIC_RELAXED);
+    size_t total = __atomic_add_fetch(&total_size, obj->bytes, __ATOMIC_RELAXED);
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    // evict until the cache fits in its budget again, never obj itself
+    while (total > MAX_CACHE_SIZE && cache_evict_one(shard, obj)) {
+        total = __atomic_load_n(&total_size, __ATOMIC_RELAXED);
+    }
+}
+
+/* insert a copy of a response into the cache, see cache_add
+ * ARGUMENTS:
+            * char* url - the full url of the itel to add. This includes the port.
+            * char* header - the plaintext header of the requested file (content size, type, etc.)
+            * char* item - pointer to the memory location of the content of the file to be cached
+            * size_t size - size of the file (not including the header's size)
+ */
+void cache_insert(char *url, char* header, char *item, size_t size) {
+    cache_obj_t *obj = cache_obj_new(url, header, size);
+    if (obj) {
+        memcpy(obj->content, item, size);
+        cache_add(obj);
+    }
+}
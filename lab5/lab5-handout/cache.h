@@ -0,0 +1,52 @@
+/**
+ * @file cache.h
+ *
+ * The web object cache shared by all the threads of the proxy
+ * see cache.c for how it is split into independently locked shards
+ */
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stddef.h>
+
+/* log2 of the number of shards, may be set with -D (0 gives one shard behind one lock) */
+#ifndef CACHE_SHARD_BITS
+#define CACHE_SHARD_BITS 4
+#endif
+#define CACHE_SHARDS (1 << CACHE_SHARD_BITS)
+
+/* byte budget of the whole cache (urls, headers and contents) */
+extern size_t MAX_CACHE_SIZE;
+
+/* A cached web object: one allocation holding this struct, then the header, the
+ * content and the url back to back. Once it is in the cache it never changes, so whoever
+ * holds a reference (from cache_lookup or cache_obj_new) may read header and content
+ * without a lock, until cache_release. The first fields belong to cache.c.
+ */
+typedef struct cache_obj {
+    struct cache_obj *hnext;   //next object in the same hash bucket
+    struct cache_obj *prev;    //neighbours on the CLOCK ring of the shard
+    struct cache_obj *next;
+    unsigned int hash;         //hash of the url, kept so growing the table does not rehash strings
+    int referenced;            //set by every hit, cleared by the CLOCK hand
+    int refcount;              //one for the cache while it holds the object, one per reader
+    size_t bytes;              //bytes charged to the budget: the whole allocation
+
+    char *url;
+    char *header;              //header_len bytes (no '\0'), directly followed by the content
+    size_t header_len;
+    char *content;             //may contain characters OR arbitary data (binary data)
+    size_t size;               //units is bytes
+} cache_obj_t;
+
+void cache_init();
+void cache_free();
+void cache_print();
+cache_obj_t* cache_lookup(char *url);
+void cache_release(cache_obj_t *obj);
+cache_obj_t* cache_obj_new(char *url, char *header, size_t size);
+void cache_add(cache_obj_t *obj);
+void cache_insert(char *url, char* header, char *item, size_t size);
+
+#endif /* __CACHE_H__ */
@@ -0,0 +1,154 @@
+/**
+ * @file cachebench.c
+ *
+ * load benchmark for the proxy cache: how many hits per second cache_lookup
+ * serves as the number of threads that look up urls at the same time grows
+ *
+ * The cache is filled with NENTRIES entries first. Then for 1, 2, 4, ... threads
+ * every thread looks up random urls among them, which all hit, for SECS seconds,
+ * and the hits of all threads together are printed per second and per thread.
+ * Build it with CACHE_SHARD_BITS=0 (make cachebench-global) to compare against
+ * the whole cache behind one lock.
+ *
+ * usage: ./cachebench [-t <max threads>] [-n <entries>] [-s <bytes per entry>] [-d <secs>]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "cache.h"
+
+#define NENTRIES 10000
+#define ENTRY_SIZE 1024
+#define SECS 1.0
+#define URL_LEN 64
+
+/* what every benchmark thread is given and hands back */
+typedef struct {
+    unsigned int seed;
+    unsigned long hits;
+    unsigned long misses;
+} worker_t;
+
+static int nentries = NENTRIES;
+static pthread_barrier_t start;
+static volatile int stop;
+
+static void *worker(void *arg);
+static void make_url(char *url, int i);
+static double now();
+
+int main(int argc, char **argv) {
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t entry_size = ENTRY_SIZE;
+    double secs = SECS;
+    int c;
+
+    if (max_threads < 4) {
+        max_threads = 4;
+    }
+    while ((c = getopt(argc, argv, "t:n:s:d:")) != -1) {
+        switch (c) {
+        case 't': max_threads = atoi(optarg); break;
+        case 'n': nentries = atoi(optarg); break;
+        case 's': entry_size = atol(optarg); break;
+        case 'd': secs = atof(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-t <max threads>] [-n <entries>] [-s <bytes per entry>] [-d <secs>]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (max_threads < 1 || nentries < 1) {
+        fprintf(stderr, "need at least one thread and one entry\n");
+        exit(1);
+    }
+
+    /* fill the cache, with room for every entry */
+    char url[URL_LEN];
+    char *content = calloc(entry_size, 1);
+    MAX_CACHE_SIZE = (size_t) nentries * (entry_size + 2 * URL_LEN + 64);
+    cache_init();
+    for (int i = 0; i < nentries; i++) {
+        make_url(url, i);
+        cache_insert(url, "HTTP/1.0 200 OK\r\n\r\n", content, entry_size);
+    }
+    free(content);
+
+    printf("%d shards, %d entries of %zd bytes, %.1f secs per run\n",
+           CACHE_SHARDS, nentries, entry_size, secs);
+    printf("%8s %14s %14s %8s\n", "threads", "hits/s", "hits/s/thread", "misses");
+
+    for (int nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+        pthread_t tids[nthreads];
+        worker_t workers[nthreads];
+        unsigned long hits = 0, misses = 0;
+
+        stop = 0;
+        pthread_barrier_init(&start, NULL, nthreads + 1);
+        for (int t = 0; t < nthreads; t++) {
+            workers[t].seed = 2 * t + 1;
+            pthread_create(&tids[t], NULL, worker, &workers[t]);
+        }
+
+        pthread_barrier_wait(&start);
+        double begin = now();
+        struct timespec ts = { (time_t) secs, (long) ((secs - (time_t) secs) * 1e9) };
+        nanosleep(&ts, NULL);
+        stop = 1;
+        for (int t = 0; t < nthreads; t++) {
+            pthread_join(tids[t], NULL);
+            hits += workers[t].hits;
+            misses += workers[t].misses;
+        }
+        double elapsed = now() - begin;
+        pthread_barrier_destroy(&start);
+
+        printf("%8d %14.0f %14.0f %8lu\n", nthreads, hits / elapsed, hits / elapsed / nthreads, misses);
+        if (nthreads < max_threads && nthreads * 2 > max_threads) {
+            nthreads = max_threads / 2;   // end on max_threads itself
+        }
+    }
+
+    cache_free();
+    return 0;
+}
+
+/* look up random urls of the cache until the main thread says stop */
+static void *worker(void *arg) {
+    worker_t *w = arg;
+    unsigned int x = w->seed;
+    char url[URL_LEN];
+
+    w->hits = w->misses = 0;
+    pthread_barrier_wait(&start);
+    while (!stop) {
+        x ^= x << 13;   // xorshift32
+        x ^= x >> 17;
+        x ^= x << 5;
+        make_url(url, x % nentries);
+        cache_obj_t *obj = cache_lookup(url);
+        if (obj) {
+            w->hits++;
+            cache_release(obj);
+        } else {
+            w->misses++;
+        }
+    }
+    return NULL;
+}
+
+/* the url of entry i */
+static void make_url(char *url, int i) {
+    snprintf(url, URL_LEN, "http://localhost:8080/object/%d.html", i);
+}
+
+/* the time in seconds */
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,654 @@
+/**
+ * @file event.c
+ *
+ * the event-driven engine of the proxy (proxy -e)
+ *
+ * Instead of a thread blocking on one client at a time, every thread here runs an
+ * epoll loop over many connections, all with non-blocking sockets. Every thread has
+ * a listening socket of its own on the same port (SO_REUSEPORT), so the kernel
+ * spreads new connections over the threads without a shared accept lock, and a
+ * connection stays on the thread that accepted it.
+ *
+ * Every connection is a small state machine that a ready socket moves forward as far
+ * as it can go without blocking:
+ *
+ *   READ_REQUEST -> cache hit -> WRITE_RESPONSE --------------------> (keep-alive)
+ *        |                                                               |
+ *        +-> miss -> CONNECT_ORIGIN -> SEND_REQUEST -> RELAY_HEADERS -> RELAY_BODY
+ *
+ * The cache of cache.c stays in front: a hit is written straight from the pinned
+ * cache object, and a miss whose length is known and small enough is read from the
+ * origin directly into a new cache object, which is added once it is complete.
+ * Connections are kept alive when the client asks for it and the response has a
+ * known length, so a client may send one request after the other on it. The origin's
+ * hop-by-hop header fields are dropped before the response is relayed or cached, and
+ * every response says for itself whether the connection stays open.
+ *
+ * Name resolution (getaddrinfo) of the origin is the one call that may still block.
+ */
+
+#define _GNU_SOURCE     /* for accept4, memmem and strcasestr (and why csapp.h is not included) */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+#include "cache.h"
+#include "proxy.h"
+#include "event.h"
+
+#define MAX_EVENTS 256     //events taken from epoll_wait at once
+#define MAXLINE 8192       //longest request (headers included), as in csapp.h
+#define MAXBUF 8192        //relay buffer, as in csapp.h
+#define LISTENQ 1024       //second argument to listen(), as in csapp.h
+#define UNTIL_CLOSE SIZE_MAX //body_left of a response without Content-length
+
+/* where a connection is */
+typedef enum {
+    READ_REQUEST,   //reading the request line and headers from the client
+    WRITE_RESPONSE, //writing a complete response (a cache hit or an error) to the client
+    CONNECT_ORIGIN, //waiting for the non-blocking connect to the origin server
+    SEND_REQUEST,   //writing the request to the origin
+    RELAY_HEADERS,  //reading the response headers from the origin
+    RELAY_BODY,     //copying the body from the origin to the client
+} state_t;
+
+/* what a step of the state machine did */
+enum { STEP_NEXT, STEP_WAIT, STEP_CLOSE };
+
+/* a client connection, and the origin connection it has while it relays */
+typedef struct conn {
+    int epfd;                 //epoll instance of the thread that owns the connection
+    int client;               //-1 once the connection is closed
+    int origin;               //-1 unless connected (or connecting) to the origin
+    uint32_t client_events;   //what epoll watches for on each socket (0: not registered)
+    uint32_t origin_events;
+    state_t state;
+    bool keep_alive;          //the next request may come on the same connection
+    char in[MAXLINE];         //bytes from the client not handled yet
+    size_t in_len;
+    char *url;                //url of the request being relayed
+    struct addrinfo *addrs;   //addresses of the origin, and the next one to try
+    struct addrinfo *next_addr;
+    char *out;                //MAXBUF bytes: the request, then the response headers and body
+    size_t out_len;
+    struct iovec iov[3];      //bytes waiting to be written
+    int iovcnt;
+    cache_obj_t *obj;         //pinned cache hit being written, or the object the relay fills
+    size_t body_left;         //body bytes still to come from the origin, or UNTIL_CLOSE
+    size_t body_done;         //body bytes read into obj
+    struct conn *dead_next;   //closed connections are freed after the batch of events
+} conn_t;
+
+static char BAD_REQUEST[] = "HTTP/1.0 400 Bad Request\r\nContent-length: 0\r\n\r\n";
+static char BAD_GATEWAY[] = "HTTP/1.0 502 Bad Gateway\r\nContent-length: 0\r\n\r\n";
+static char KEEP_ALIVE[] = "Connection: keep-alive\r\n\r\n";
+static char CLOSE[] = "Connection: close\r\n\r\n";
+
+
+/* make epoll watch fd for events (nothing if 0) on behalf of conn */
+static void watch(conn_t *conn, int fd, uint32_t *current, uint32_t events) {
+    if (fd < 0 || *current == events) {
+        return;
+    }
+    struct epoll_event ev = { .events = events, .data.ptr = conn };
+    int op = *current == 0 ? EPOLL_CTL_ADD : events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+    if (epoll_ctl(conn->epfd, op, fd, &ev) < 0) {
+        perror("epoll_ctl");
+    }
+    *current = events;
+}
+
+/* set what the connection waits for on the client and on the origin socket
+ * a socket that is not waited on is taken out of epoll, so it cannot wake the loop
+ * up for nothing (for instance with a hang-up) while the other one is waited on
+ */
+static void conn_watch(conn_t *conn, uint32_t client, uint32_t origin) {
+    watch(conn, conn->client, &conn->client_events, client);
+    watch(conn, conn->origin, &conn->origin_events, origin);
+}
+
+/* close the origin socket of a connection, if it has one */
+static void origin_close(conn_t *conn) {
+    if (conn->origin >= 0) {
+        close(conn->origin);
+        conn->origin = -1;
+        conn->origin_events = 0;
+    }
+}
+
+/* let go of everything a connection holds for the request it is serving */
+static void conn_reset(conn_t *conn) {
+    origin_close(conn);
+    if (conn->obj) {
+        cache_release(conn->obj);
+        conn->obj = NULL;
+    }
+    if (conn->addrs) {
+        freeaddrinfo(conn->addrs);
+        conn->addrs = conn->next_addr = NULL;
+    }
+    free(conn->url);
+    conn->url = NULL;
+    free(conn->out);
+    conn->out = NULL;
+    conn->out_len = 0;
+    conn->iovcnt = 0;
+}
+
+/* close a connection, which is freed once the current batch of events is handled,
+ * since a later event of the batch may still point to it
+ */
+static void conn_close(conn_t *conn, conn_t **dead) {
+    conn_reset(conn);
+    close(conn->client);
+    conn->client = -1;
+    conn->dead_next = *dead;
+    *dead = conn;
+}
+
+/* write as much of the pending iov as fd takes without blocking
+ * RETURN: 1 if all of it is written, 0 if fd is full, -1 if fd failed
+ */
+static int flush(conn_t *conn, int fd) {
+    while (conn->iovcnt > 0) {
+        ssize_t n = writev(fd, conn->iov, conn->iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        // skip the buffers written completely, and the written part of the next one
+        int i = 0;
+        while (i < conn->iovcnt && (size_t) n >= conn->iov[i].iov_len) {
+            n -= conn->iov[i].iov_len;
+            i++;
+        }
+        memmove(conn->iov, conn->iov + i, (conn->iovcnt - i) * sizeof(struct iovec));
+        conn->iovcnt -= i;
+        if (conn->iovcnt > 0) {
+            conn->iov[0].iov_base = (char*) conn->iov[0].iov_base + n;
+            conn->iov[0].iov_len -= n;
+        }
+    }
+    return 1;
+}
+
+/* answer the client with one of the canned error responses, then close */
+static int respond_error(conn_t *conn, char *response) {
+    conn_reset(conn);
+    conn->iov[0].iov_base = response;
+    conn->iov[0].iov_len = strlen(response);
+    conn->iovcnt = 1;
+    conn->keep_alive = false;
+    conn->state = WRITE_RESPONSE;
+    return STEP_NEXT;
+}
+
+/* queue the header of a response for the client, with the proxy's own Connection line
+ * (keep-alive or close) in place of its blank line, which that line ends with instead
+ * PRECONDITION: header has no hop-by-hop fields of the origin left (see strip_hop_headers)
+ */
+static void queue_header(conn_t *conn, char *header, size_t header_len) {
+    char *connection = conn->keep_alive ? KEEP_ALIVE : CLOSE;
+
+    conn->iovcnt = 0;
+    conn->iov[conn->iovcnt++] = (struct iovec) { header, header_len - 2 };
+    conn->iov[conn->iovcnt++] = (struct iovec) { connection, strlen(connection) };
+}
+
+/* remove the hop-by-hop fields (Connection, Proxy-Connection and Keep-Alive) from the
+ * header at the start of buf, which only concern the origin's connection to the proxy;
+ * the rest of buf (len bytes in all) moves down behind what is left of the header
+ * RETURN: how many bytes were removed
+ */
+static size_t strip_hop_headers(char *buf, size_t header_len, size_t len) {
+    static char *hop[] = { "Connection:", "Proxy-Connection:", "Keep-Alive:" };
+    size_t removed = 0;
+    char *line = memmem(buf, header_len, "\r\n", 2);
+
+    // line is the CRLF in front of a field, up to the one in front of the blank line
+    while (line && line + 4 <= buf + header_len - removed) {
+        char *field = line + 2;
+        char *eol = memmem(field, buf + header_len - removed - field, "\r\n", 2);
+        bool is_hop = false;
+        for (size_t i = 0; i < sizeof(hop) / sizeof(hop[0]); i++) {
+            is_hop |= strncasecmp(field, hop[i], strlen(hop[i])) == 0;
+        }
+        if (!is_hop) {
+            line = eol;
+            continue;
+        }
+        memmove(field, eol + 2, buf + len - removed - (eol + 2));
+        removed += eol + 2 - field;
+    }
+    return removed;
+}
+
+/* whether a request (NUL terminated, headers included) lets the connection stay open:
+ * by default for HTTP/1.1, and as its Connection or Proxy-Connection header says
+ */
+static bool wants_keep_alive(char *request, char *version) {
+    bool keep = strcmp(version, "HTTP/1.1") == 0;
+    for (char *line = strstr(request, "\r\n"); line && line[2] != '\r'; line = strstr(line + 2, "\r\n")) {
+        char *field = line + 2;
+        if (strncasecmp(field, "Connection:", 11) == 0 || strncasecmp(field, "Proxy-Connection:", 17) == 0) {
+            char value[64];
+            char *eol = strstr(field, "\r\n");
+            snprintf(value, sizeof(value), "%.*s", (int) (eol - field), field);
+            if (strcasestr(value, "close")) {
+                keep = false;
+            } else if (strcasestr(value, "keep-alive")) {
+                keep = true;
+            }
+        }
+    }
+    return keep;
+}
+
+/* the Content-length of a response header (NUL terminated), or UNTIL_CLOSE */
+static size_t content_length(char *header) {
+    for (char *line = strstr(header, "\r\n"); line && line[2] != '\r'; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-length:", 15) == 0) {
+            return strtoul(line + 17, NULL, 10);
+        }
+    }
+    return UNTIL_CLOSE;
+}
+
+/* start a non-blocking connect to the next address of the origin
+ * RETURN: false if there is no address left to try
+ */
+static bool origin_connect(conn_t *conn) {
+    origin_close(conn);
+    for (; conn->next_addr; conn->next_addr = conn->next_addr->ai_next) {
+        struct addrinfo *p = conn->next_addr;
+        int fd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK, p->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, p->ai_addr, p->ai_addrlen) == 0 || errno == EINPROGRESS) {
+            conn->origin = fd;
+            conn->next_addr = p->ai_next;
+            return true;
+        }
+        close(fd);
+    }
+    return false;
+}
+
+/* READ_REQUEST: read until the end of the request headers, then answer it from the
+ * cache or start connecting to the origin
+ */
+static int step_read_request(conn_t *conn) {
+    char *end;
+    while (!(end = memmem(conn->in, conn->in_len, "\r\n\r\n", 4))) {
+        if (conn->in_len == sizeof(conn->in) - 1) {
+            return respond_error(conn, BAD_REQUEST);
+        }
+        ssize_t n = read(conn->client, conn->in + conn->in_len, sizeof(conn->in) - 1 - conn->in_len);
+        if (n > 0) {
+            conn->in_len += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            conn_watch(conn, EPOLLIN, 0);
+            return STEP_WAIT;
+        } else {
+            return STEP_CLOSE;   // the client is gone, or done
+        }
+    }
+
+    char method[MAXLINE], url[MAXLINE], version[MAXLINE], url_trim[MAXLINE];
+    char hostname[MAXLINE], port[MAXLINE], resource[MAXLINE];
+    size_t request_len = end + 4 - conn->in;
+    char saved = conn->in[request_len];
+
+    conn->in[request_len] = '\0';
+    // nothing but a complete request line sets url, resource, hostname and port
+    bool parsed = parse_request(conn->in, method, url, version, url_trim, resource, port, hostname);
+    conn->keep_alive = parsed && wants_keep_alive(conn->in, version);
+    conn->in[request_len] = saved;
+
+    // a pipelined request may follow this one
+    memmove(conn->in, conn->in + request_len, conn->in_len - request_len);
+    conn->in_len -= request_len;
+
+    if (!parsed) {
+        return respond_error(conn, BAD_REQUEST);
+    }
+
+    if ((conn->obj = cache_lookup(url))) {
+        queue_header(conn, conn->obj->header, conn->obj->header_len);
+        conn->iov[conn->iovcnt++] = (struct iovec) { conn->obj->content, conn->obj->size };
+        conn->state = WRITE_RESPONSE;
+        return STEP_NEXT;
+    }
+
+    // the request for the origin waits in out until the connection is up
+    conn->url = strdup(url);
+    conn->out = malloc(MAXBUF);
+    conn->out_len = snprintf(conn->out, MAXBUF, "GET /%s HTTP/1.0\r\nHost: %s:%s\r\n\r\n",
+                             resource, hostname, port);
+    if (conn->out_len >= MAXBUF) {
+        return respond_error(conn, BAD_REQUEST);
+    }
+    conn->iov[0] = (struct iovec) { conn->out, conn->out_len };
+    conn->iovcnt = 1;
+
+    struct addrinfo hints = { .ai_socktype = SOCK_STREAM, .ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG };
+    if (getaddrinfo(hostname, port, &hints, &conn->addrs) != 0) {
+        conn->addrs = NULL;
+        return respond_error(conn, BAD_GATEWAY);
+    }
+    conn->next_addr = conn->addrs;
+    if (!origin_connect(conn)) {
+        return respond_error(conn, BAD_GATEWAY);
+    }
+    conn->state = CONNECT_ORIGIN;
+    conn_watch(conn, 0, EPOLLOUT);
+    return STEP_WAIT;
+}
+
+/* the request is done: wait for the next one if the connection is kept alive */
+static int finish_response(conn_t *conn) {
+    conn_reset(conn);
+    if (!conn->keep_alive) {
+        return STEP_CLOSE;
+    }
+    conn->state = READ_REQUEST;
+    return STEP_NEXT;
+}
+
+/* WRITE_RESPONSE: write the queued response to the client */
+static int step_write_response(conn_t *conn) {
+    int r = flush(conn, conn->client);
+    if (r < 0) {
+        return STEP_CLOSE;
+    }
+    if (r == 0) {
+        conn_watch(conn, EPOLLOUT, 0);
+        return STEP_WAIT;
+    }
+    return finish_response(conn);
+}
+
+/* CONNECT_ORIGIN: the origin socket is writable, so the connect either worked or
+ * failed; on failure try the next address of the origin
+ */
+static int step_connect_origin(conn_t *conn) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(conn->origin, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+        if (!origin_connect(conn)) {
+            return respond_error(conn, BAD_GATEWAY);
+        }
+        conn_watch(conn, 0, EPOLLOUT);
+        return STEP_WAIT;
+    }
+    conn->state = SEND_REQUEST;
+    return STEP_NEXT;
+}
+
+/* SEND_REQUEST: write the request to the origin */
+static int step_send_request(conn_t *conn) {
+    int r = flush(conn, conn->origin);
+    if (r < 0) {
+        return respond_error(conn, BAD_GATEWAY);
+    }
+    if (r == 0) {
+        conn_watch(conn, 0, EPOLLOUT);
+        return STEP_WAIT;
+    }
+    conn->out_len = 0;
+    conn->state = RELAY_HEADERS;
+    return STEP_NEXT;
+}
+
+/* RELAY_HEADERS: read the response headers of the origin into out, then queue them
+ * for the client, with whatever part of the body came along
+ */
+static int step_relay_headers(conn_t *conn) {
+    char *end;
+    while (!(end = memmem(conn->out, conn->out_len, "\r\n\r\n", 4))) {
+        if (conn->out_len == MAXBUF - 1) {
+            return respond_error(conn, BAD_GATEWAY);
+        }
+        ssize_t n = read(conn->origin, conn->out + conn->out_len, MAXBUF - 1 - conn->out_len);
+        if (n > 0) {
+            conn->out_len += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            conn_watch(conn, 0, EPOLLIN);
+            return STEP_WAIT;
+        } else {
+            return respond_error(conn, BAD_GATEWAY);
+        }
+    }
+
+    size_t header_len = end + 4 - conn->out;
+    // the client gets the proxy's own Connection line instead, and so does every later hit
+    size_t removed = strip_hop_headers(conn->out, header_len, conn->out_len);
+    header_len -= removed;
+    conn->out_len -= removed;
+    char saved = conn->out[header_len];
+    conn->out[header_len] = '\0';
+
+    conn->body_left = content_length(conn->out);
+    conn->body_done = 0;
+    if (conn->body_left == UNTIL_CLOSE) {
+        conn->keep_alive = false;   // only the origin closing ends the body
+    } else if (conn->body_left <= MAX_ENTRY_SIZE) {
+        conn->obj = cache_obj_new(conn->url, conn->out, conn->body_left);
+    }
+    conn->out[header_len] = saved;
+
+    // the part of the body that came with the headers
+    size_t extra = conn->out_len - header_len;
+    if (extra > conn->body_left) {
+        extra = conn->body_left;
+    }
+    if (conn->obj) {
+        memcpy(conn->obj->content, conn->out + header_len, extra);
+        conn->body_done = extra;
+    }
+    if (conn->body_left != UNTIL_CLOSE) {
+        conn->body_left -= extra;
+    }
+
+    queue_header(conn, conn->out, header_len);
+    conn->iov[conn->iovcnt++] = (struct iovec) { conn->out + header_len, extra };
+    conn->state = RELAY_BODY;
+    return STEP_NEXT;
+}
+
+/* RELAY_BODY: write what is queued to the client, then read more of the body from the
+ * origin; a cacheable body is read straight into its cache object and written from there
+ * only one of the two sockets is waited on at a time, so a slow client slows the origin down
+ */
+static int step_relay_body(conn_t *conn) {
+    int r = flush(conn, conn->client);
+    if (r < 0) {
+        return STEP_CLOSE;
+    }
+    if (r == 0) {
+        conn_watch(conn, EPOLLOUT, 0);
+        return STEP_WAIT;
+    }
+
+    if (conn->body_left == 0) {
+        if (conn->obj) {
+            cache_add(conn->obj);   // the reference passes to the cache
+            conn->obj = NULL;
+        }
+        return finish_response(conn);
+    }
+
+    char *dst = conn->obj ? conn->obj->content + conn->body_done : conn->out;
+    size_t room = conn->obj ? conn->body_left : MAXBUF;
+    if (room > conn->body_left) {
+        room = conn->body_left;
+    }
+    ssize_t n = read(conn->origin, dst, room);
+    if (n > 0) {
+        if (conn->obj) {
+            conn->body_done += n;
+        }
+        if (conn->body_left != UNTIL_CLOSE) {
+            conn->body_left -= n;
+        }
+        conn->iov[0] = (struct iovec) { dst, n };
+        conn->iovcnt = 1;
+        return STEP_NEXT;
+    }
+    if (n < 0 && errno == EINTR) {
+        return STEP_NEXT;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        conn_watch(conn, 0, EPOLLIN);
+        return STEP_WAIT;
+    }
+    if (n == 0 && conn->body_left == UNTIL_CLOSE) {
+        return finish_response(conn);   // keep_alive is off, so this closes
+    }
+    return STEP_CLOSE;   // the origin failed or cut the body short
+}
+
+/* move a connection forward until it has to wait for a socket, or is closed */
+static void conn_run(conn_t *conn, conn_t **dead) {
+    int r;
+    if (conn->client < 0) {
+        return;   // closed earlier in this batch of events
+    }
+    do {
+        switch (conn->state) {
+        case READ_REQUEST:   r = step_read_request(conn); break;
+        case WRITE_RESPONSE: r = step_write_response(conn); break;
+        case CONNECT_ORIGIN: r = step_connect_origin(conn); break;
+        case SEND_REQUEST:   r = step_send_request(conn); break;
+        case RELAY_HEADERS:  r = step_relay_headers(conn); break;
+        case RELAY_BODY:     r = step_relay_body(conn); break;
+        default:             r = STEP_CLOSE; break;
+        }
+    } while (r == STEP_NEXT);
+    if (r == STEP_CLOSE) {
+        conn_close(conn, dead);
+    }
+}
+
+/* accept every connection waiting on listenfd, and wait for their requests */
+static void accept_all(int epfd, int listenfd) {
+    while (1) {
+        int connfd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK);
+        if (connfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept4");
+            }
+            return;
+        }
+        conn_t *conn = (conn_t*) calloc(1, sizeof(conn_t));
+        if (!conn) {
+            close(connfd);
+            continue;
+        }
+        conn->epfd = epfd;
+        conn->client = connfd;
+        conn->origin = -1;
+        conn->state = READ_REQUEST;
+        conn_watch(conn, EPOLLIN, 0);
+    }
+}
+
+/* open a non-blocking listening socket on port that other threads may bind too
+ * RETURN: the socket, or -1
+ */
+static int open_listenfd_reuseport(char *port) {
+    struct addrinfo hints = { .ai_socktype = SOCK_STREAM,
+                              .ai_flags = AI_PASSIVE | AI_ADDRCONFIG | AI_NUMERICSERV };
+    struct addrinfo *list, *p;
+    int listenfd = -1, optval = 1;
+
+    if (getaddrinfo(NULL, port, &hints, &list) != 0) {
+        return -1;
+    }
+    for (p = list; p; p = p->ai_next) {
+        if ((listenfd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK, p->ai_protocol)) < 0) {
+            continue;
+        }
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(int));
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(int));
+        if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0 && listen(listenfd, LISTENQ) == 0) {
+            break;
+        }
+        close(listenfd);
+        listenfd = -1;
+    }
+    freeaddrinfo(list);
+    return listenfd;
+}
+
+/* the loop every engine thread runs, over its own listening socket and connections
+ * ARGUMENT: void* port - the port to listen on
+ */
+static void* event_loop(void *port) {
+    struct epoll_event events[MAX_EVENTS];
+    int epfd = epoll_create1(0);
+    int listenfd = open_listenfd_reuseport((char*) port);
+
+    if (epfd < 0 || listenfd < 0) {
+        fprintf(stderr, "event_loop: unable to listen on port %s\n", (char*) port);
+        exit(1);
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+
+    while (1) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        conn_t *dead = NULL;
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_all(epfd, listenfd);
+            } else {
+                conn_run((conn_t*) events[i].data.ptr, &dead);
+            }
+        }
+        while (dead) {
+            conn_t *next = dead->dead_next;
+            free(dead);
+            dead = next;
+        }
+    }
+    return NULL;
+}
+
+/* run the event-driven engine: nthreads threads, each with its own listening socket
+ * on port and its own epoll loop; never returns
+ * ARGUMENTS:
+            * char* port - the port to listen on
+            * int nthreads - the number of threads, one per core is the idea
+ */
+void event_run(char *port, int nthreads) {
+    pthread_t tid;
+
+    for (int i = 1; i < nthreads; i++) {
+        if (pthread_create(&tid, NULL, event_loop, port) != 0) {
+            fprintf(stderr, "event_run: unable to start thread %d\n", i);
+            exit(1);
+        }
+    }
+    event_loop(port);
+}
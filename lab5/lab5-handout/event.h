@@ -0,0 +1,12 @@
+/**
+ * @file event.h
+ *
+ * the event-driven engine of the proxy, see event.c
+ */
+
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+void event_run(char *port, int nthreads);
+
+#endif /* __EVENT_H__ */
@@ -6,10 +6,14 @@
  * 
  * Zero known bugs
  * Caching and multithreading implemented
- * multithreaded via Pthread_create and Pthread_detach, one only 
- * task identifyied as critical is the incersion into the shared cache
- * a new thread is started whenever there is a new cleint who reaches out to 
- * the listening port of the proxy
+ * the cache lives in cache.c: shards with a reader-writer lock each, every one a hash
+ * table on the url, with CLOCK eviction once they hold MAX_CACHE_SIZE bytes in all
+ * multithreaded via a fixed pool of worker threads started by main (or, with -e, 
+ * event-driven by the epoll engine in event.c), the only tasks
+ * identifyied as critical are the lookups in and incersions into the shared cache,
+ * which cache.c locks shard by shard, and the queue of accepted connections
+ * main accepts every new cleint who reaches out to the listening port of the proxy
+ * and queues the connection for the next free worker
  *
  * caching works by breaking the response into a header which contains all the header
  * line and a content. The content is treated as unbitrary bytes so that cache works
@@ -22,141 +26,153 @@
  */
 
 #include "csapp.h"
+#include "cache.h"
+#include "proxy.h"
+#include "event.h"
 #include <stdbool.h>
 #include <stdio.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
 
 
 /* Constands */
 char *DEFAULT_PORT = "80";
 size_t MAX_ENTRY_SIZE = 400000;
+int THREADS_PER_CORE = 4;   //workers per core by default, more than one since a worker blocks on I/O
+size_t QUEUE_SIZE = 1024;   //accepted connections waiting for a worker by default
+int ACCEPT_BACKOFF_US = 10000; //pause of main when out of descriptors, so workers can close some
 /* MAXLINE is 1024 bytes */
 
 
-
-/* Struct used to hold all pertinent info to be cached */
-typedef struct cache_entry {
-    char *url;
-    char *header;
-    char *content; //may contain characters OR arbitary data (binary data)
-    struct cache_entry *next;
-    size_t size;  //units is bytes
-} cache_entry_t; 
-
-/* struct acting as the head to the linked list holding cached information */
+/* bounded queue of accepted connections, filled by main and emptied by the workers */
 typedef struct {
-    cache_entry_t *head;
-    size_t total_size;
-} cache_t;
-
+    int *fds;           //ring buffer of connfds
+    size_t capacity;
+    size_t head;        //next connfd to hand to a worker
+    size_t count;
+    bool reject;        //when full: turn new clients away instead of waiting for room
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} conn_queue_t;
 
 /* Global Variables */
-pthread_mutex_t mutex; //used to signal when threads need to pause to prevent data races
-cache_t *cache; //global variable to point to the in-memory cache
+conn_queue_t queue; //connections accepted but not yet taken by a worker
 
-/* print out the contents of the cache */
-void cache_print() {
-    cache_entry_t *cur = cache->head;
-    printf("current cache: (%zd)\n", cache->total_size);
-    while(cur) {
-        printf("%s (%zd)\n", cur->url, cur->size);
-        cur = cur->next;
-    }
+/* initialize the connection queue
+ * ARGUMENTS:
+            * size_t capacity - how many connections may wait for a worker
+            * bool reject - what to do when that many are waiting (see queue_put)
+ */
+void queue_init(size_t capacity, bool reject) {
+    queue.fds = (int*) Malloc(capacity * sizeof(int));
+    queue.capacity = capacity;
+    queue.head = 0;
+    queue.count = 0;
+    queue.reject = reject;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.not_empty, NULL);
+    pthread_cond_init(&queue.not_full, NULL);
 }
 
-/* initialize the global cache variable (allocate memory and initialize fields) 
- * No arguments, no return, no critical sections, called at the start of main
-*/
-void cache_init() {
-    printf("init created\n");
-    cache = (cache_t*) malloc(sizeof(cache_t));
-    cache->total_size = 0;
-    cache->head = NULL;
-    printf("cache value is %p", cache);
+/* hand an accepted connection to the workers
+ * this is where the backpressure is: when the queue is full, main either waits for a
+ * worker to take a connection, and stops accepting meanwhile so new clients queue up
+ * in the kernel's listen backlog, or (with reject set) gives up on this connection
+ * ARGUMENT: int connfd - the client's file descriptor
+ * RETURN:
+         * true - if the connection is queued
+         * false - if the queue was full and reject is set; the caller still owns connfd
+ * CRITICAL SECTIONS: the queue lock
+ */
+bool queue_put(int connfd) {
+    pthread_mutex_lock(&queue.lock);
+    while (queue.count == queue.capacity) {
+        if (queue.reject) {
+            pthread_mutex_unlock(&queue.lock);
+            return false;
+        }
+        pthread_cond_wait(&queue.not_full, &queue.lock);
+    }
+    queue.fds[(queue.head + queue.count) % queue.capacity] = connfd;
+    queue.count++;
+    pthread_cond_signal(&queue.not_empty);
+    pthread_mutex_unlock(&queue.lock);
+    return true;
 }
 
-/* deallocate the entire cache (all the entries and the cache global variable) 
- * No arguments, no return, no critical sections, called at the end of main
+/* take the connection that has waited longest, waiting for one if there is none
+ * RETURN: the client's file descriptor, which the caller now owns
+ * CRITICAL SECTIONS: the queue lock
  */
-void cache_free() {
-    cache_entry_t *cur = cache->head;
-    cache_entry_t *next;
-    while(cur) {
-        next = cur->next;
-        free(cur->header);
-        free(cur->content);
-        free(cur->url);
-        free(cur);
-        cur = next;
-    }
-    free(cache);
+int queue_get() {
+    pthread_mutex_lock(&queue.lock);
+    while (queue.count == 0) {
+        pthread_cond_wait(&queue.not_empty, &queue.lock);
+    }
+    int connfd = queue.fds[queue.head];
+    queue.head = (queue.head + 1) % queue.capacity;
+    queue.count--;
+    pthread_cond_signal(&queue.not_full);
+    pthread_mutex_unlock(&queue.lock);
+    return connfd;
 }
 
-/* search cache for an entry with a matching url 
- * ARGUMENT: char* url - string that contains the url of the item to look up
- * RETURN: 
-         * a pointer to the matching entry if found
-         * NULL if no matching entry is found
-*/
-cache_entry_t* cache_lookup(char *url) {
-    cache_entry_t *cur = cache->head;
-    while(cur) {
-        if (strcmp(cur->url, url) == 0) {
-            return cur;
+/* write every byte described by iov to fd, with as few writev calls as it takes
+ * ARGUMENTS:
+            * int fd - the file descriptor to write to
+            * struct iovec* iov - the buffers to write, in order (advanced as they are written)
+            * int iovcnt - the number of buffers
+ * RETURN:
+         * true - if everything was written
+         * false - if fd failed (e.g. the client went away)
+ */
+bool writev_all(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        // skip the buffers written completely, and the written part of the next one
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= n;
         }
-        cur = cur->next;
     }
-    return NULL;
+    return true;
 }
 
-/* insert a new entry at the head of the cache
+/* CALLED BY handle_request()
+ * write n bytes of buf to fd, like Rio_writen but without exiting the proxy when fd
+ * fails: a client that resets its connection only ends its own request
  * ARGUMENTS:
-            * char* url - the full url of the itel to add. This includes the port.
-            * char* header - the plaintext header of the requested file (content size, type, etc.)
-            * char* item - pointer to the memory location of the content of the file to be cached
-            * size_t size - size of the file (not including the header's size)
- * CRITICAL SECTIONS: mutex lock used during modification of the global variable 'cache'
+            * int fd - the file descriptor to write to
+            * void* buf - the bytes to write
+            * size_t n - how many
+ * RETURN:
+         * true - if everything was written
+         * false - if fd failed (e.g. the client went away)
  */
-void cache_insert(char *url, char* header, char *item, size_t size) {
-    cache_entry_t *newitem = (cache_entry_t*) malloc(sizeof(cache_entry_t));
-
-    // set url
-    newitem->url = malloc(strlen(url)+1);
-    strncpy(newitem->url, url, strlen(url)+1);
-
-    // insert header
-    newitem->header = malloc(strlen(header)+1);
-    strncpy(newitem->header, header, strlen(header)+1);
-
-    // set content
-    newitem->content = malloc(size);
-    memcpy(newitem->content, item, size);
-
-    // set size
-    newitem->size = size;
-
-    // adding content from different threads to the same linked list may 
-    // causes a data race or other issue thus we set a mutex lock 
-    pthread_mutex_lock(&mutex);
-
-    /* If it will be the first item, set its next item to NULL; otherwise insert normally */
-    if (cache->total_size == 0) {
-        cache->head = newitem;
-        newitem->next = NULL;
-    } else {
-        cache_entry_t *old_first_item = cache->head;
-        cache->head = newitem;
-        newitem->next = old_first_item;
-    }
-
-    cache->total_size++; 
-
-    pthread_mutex_unlock(&mutex);
+bool write_all(int fd, void *buf, size_t n) {
+    struct iovec iov = { buf, n };
+    return writev_all(fd, &iov, 1);
 }
 
 /* ONLY CALLED BY handle_request()
  * search the cache for the requested item.
  * If it finds the item in cache, it writes the requested file to the client
  * if not, it returns to the original caller, handle_request()
+ * The cached object is pinned while it is written, so it cannot be freed even if
+ * another thread evicts it, and header and content go out in one writev straight
+ * from it
  * ARGUMENTS:
             * char* request_url - url of the requested item
             * int connfd - the file descriptor of the client
@@ -165,20 +181,26 @@ void cache_insert(char *url, char* header, char *item, size_t size) {
          * false - if we could not. This returns us to a non-cached version of handle_request()
 */
 bool can_respond_with_cache(char *request_url, int connfd){
-    cache_entry_t* entry = (cache_entry_t*) cache_lookup(request_url);
+    cache_obj_t *obj = cache_lookup(request_url);
     
     /* if we can't find an item, return false */
-    if (!entry) {
+    if (!obj) {
         return false;
     }
 
     /* Otherwise, write to the connfd and return true */
-    Rio_writen(connfd, entry->header, strlen(entry->header));
-    Rio_writen(connfd, entry->content, entry->size);
+    struct iovec iov[2] = {
+        { obj->header, obj->header_len },
+        { obj->content, obj->size },
+    };
+    if (!writev_all(connfd, iov, 2)) {
+        printf("ERROR: unable to write the cached response\n");
+    }
+    cache_release(obj);
     return true;
 }
 
-/* CALLED ONLY BY handle_request()
+/* CALLED BY handle_request() and by the event engine (event.c)
  * parses the request sent to handle_request()
  * ARGUMENTS: 
             * PREFACE: all of these are to be set during the function. 
@@ -191,24 +213,28 @@ bool can_respond_with_cache(char *request_url, int connfd){
             * char* resource   the name of the requested file
             * char* port       the port upon which the request was made
             * char* hostname   same as url_trim at the end, host name
+            * every field must hold MAXLINE bytes, as long as any word of buf may be
+ * RETURN:
+         * true - if the request line had its three parts and every field is set
+         * false - if it did not (the fields are then not to be used)
 */
-void parse_request(char *buf, char* method, char* url, char* version, 
+bool parse_request(char *buf, char* method, char* url, char* version, 
                    char* url_trim, char* resource, char *port, char*hostname){
     // parse URL for hostname, port, and filename, then open a socket on that port and hostname
 
     if (3 != sscanf(buf, "%s %s %s", method, url, version)) {
         printf("ERROR: bad scan\n");
-        return;
+        return false;
     }
 
-    if(!sscanf(url, "http://%s", url_trim)){
+    if(sscanf(url, "http://%s", url_trim) != 1){
         strncpy(url_trim, url, strlen(url)+1);
     }  
 
-    // set resource
+    // set resource (whole, a longer copy would lose its terminator)
     char* temp = strchr(url_trim, '/');
     if (temp) {
-        strncpy(resource, temp+1, 100);
+        strcpy(resource, temp+1);
         *temp = '\0';
     } else {
         strncpy(resource, "index.html", strlen("index.html")+1); //sets defualt resource
@@ -217,7 +243,7 @@ void parse_request(char *buf, char* method, char* url, char* version,
     // set port
     temp = strchr(url_trim, ':');
     if (temp) {
-        strncpy(port, temp+1, 100);
+        strcpy(port, temp+1);
         *temp = '\0';
     } else {
         strncpy(port, DEFAULT_PORT, strlen(DEFAULT_PORT)+1);
@@ -225,6 +251,7 @@ void parse_request(char *buf, char* method, char* url, char* version,
 
     // set hostname
     strncpy(hostname, url_trim, strlen(url_trim)+1); // for readability
+    return true;
 }
 
 
@@ -238,90 +265,100 @@ void parse_request(char *buf, char* method, char* url, char* version,
             * char* port       the port upon which the request was made
             * char* resource   the name of the requested file
             * int   fd_server  the file descripter to the end server
+ * RETURN:
+         * true - if the whole request was written
+         * false - if fd_server failed (e.g. the origin reset the connection)
  */
-void send_request(int fd_server, char *resource, char *buf, char*hostname, char *port){
+bool send_request(int fd_server, char *resource, char *buf, char*hostname, char *port){
     sprintf (buf, "GET /%s HTTP/1.0\r\n", resource); 
-    Rio_writen(fd_server, buf, strlen(buf));
+    if (rio_writen(fd_server, buf, strlen(buf)) < 0) {
+        return false;
+    }
 
     sprintf(buf, "Host: %s:%s\r\n", hostname, port); 
-    Rio_writen(fd_server, buf, strlen(buf));
+    if (rio_writen(fd_server, buf, strlen(buf)) < 0) {
+        return false;
+    }
 
     sprintf(buf, "\r\n");
-    Rio_writen(fd_server, buf, strlen(buf));
+    return rio_writen(fd_server, buf, strlen(buf)) >= 0;
 }
 
-/* Handles requests sent by the client.
- * This function parses the request, then it tries to use its cache to resolve it.
- * It forwards the request to the server and then forwards the response back to the client.
- * Then, it adds the item to the cache.
- * ARGUMENT: int connfd - the client's file descriptor
+/* CALLED ONLY BY relay_response()
+ * read the next line of the origin's response header into buf and pass it on to the client
+ * ARGUMENTS:
+            * rio_t* rio_server - the origin's connection
+            * char* buf - MAXLINE bytes for the line
+            * int connfd - the file descriptor of the client
+            * bool* client_ok - cleared once a write to the client fails, after which the
+              lines are only read
+ * RETURN:
+         * true - if a line was read
+         * false - if the origin failed or closed the connection first
  */
-void handle_request(int connfd) {
-    // Declaring variables to be passed into subfunctions
-    char buf[MAXLINE], method[MAXLINE], url[MAXLINE], version[MAXLINE], url_trim[MAXLINE]; 
-    char hostname[MAXLINE], port[MAXLINE], resource[MAXLINE];
-
-    /* Read request line and headers */
-    rio_t rio;
-    Rio_readinitb(&rio, connfd); //initalised the connection to read the request
-    // If we cannot read from the client, we cannot proceed
-    if (!Rio_readlineb(&rio, buf, MAXLINE)){ 
-        printf("ERROR: Unable to make a connection using the given fd\n");
-        return;
-    }   
-
-    parse_request(buf, method, url, version, url_trim, resource, port, hostname);
-
-    // We have parsed the url that would match the cache. 
-    // From here, we just need to see if we can find it in the cache.
-    if (can_respond_with_cache(url, connfd)) {
-        return;
-    }
-
-    // Forward the request to the server
-    int fd_server;
-    if ((fd_server = Open_clientfd(hostname, port)) == 0) {
-        printf("ERROR: Invalid Port\n");
-        return;
+bool relay_line(rio_t *rio_server, char *buf, int connfd, bool *client_ok) {
+    ssize_t n = rio_readlineb(rio_server, buf, MAXLINE);
+    if (n <= 0) {
+        return false;
     }
-    
-    send_request(fd_server, resource, buf, hostname, port);
+    *client_ok = *client_ok && write_all(connfd, buf, n);
+    return true;
+}
 
-    // initialize a read connection with the server
+/* CALLED ONLY BY handle_request()
+ * relays the response of the origin to the client, then adds it to the cache if it is 
+ * complete and small enough. Nothing here exits the proxy: when the origin fails the
+ * response ends there, and when the client goes away the response is still read (and cached)
+ * ARGUMENTS:
+            * int fd_server - the origin's connection, which the caller closes
+            * int connfd - the client's file descriptor
+            * char* url - the url the response is cached under
+            * char* buf - MAXLINE bytes for string movement
+ */
+void relay_response(int fd_server, int connfd, char *url, char *buf) {
     rio_t rio_server;
     Rio_readinitb(&rio_server, fd_server); 
 
-    size_t n; // This variable tells us how long our Rio_writen() will write
+    ssize_t n; // how many bytes of the content were read
+    bool client_ok = true; // once the client is gone, the response is still read (and cached)
+    char header[MAXLINE], size[MAXLINE], type[MAXLINE];
 
     // first line: header
-    n = Rio_readlineb(&rio_server, buf, MAXLINE); 
-    char header[MAXLINE];
+    if (!relay_line(&rio_server, buf, connfd, &client_ok)) {
+        printf("ERROR: the origin sent no response\n");
+        return;
+    }
     strncpy(header, buf, strlen(buf)+1);
-    Rio_writen(connfd, buf, n);
 
     // second line: server type
-    n = Rio_readlineb(&rio_server, buf, MAXLINE); // second line: size
+    if (!relay_line(&rio_server, buf, connfd, &client_ok)) {
+        printf("ERROR: the origin sent no whole header\n");
+        return;
+    }
     strcat(header, buf); // TOD may need to add \r\n
-    Rio_writen(connfd, buf, n);
 
     // third line: size
-    n = Rio_readlineb(&rio_server, buf, MAXLINE);
-    char size[MAXLINE];
+    if (!relay_line(&rio_server, buf, connfd, &client_ok)) {
+        printf("ERROR: the origin sent no whole header\n");
+        return;
+    }
     strncpy(size, buf, strlen(buf)+1);
     strcat(header, buf);
-    Rio_writen(connfd, buf, n);
 
     // fourth line: content type
-    n = Rio_readlineb(&rio_server, buf, MAXLINE);
-    char type[MAXLINE];
+    if (!relay_line(&rio_server, buf, connfd, &client_ok)) {
+        printf("ERROR: the origin sent no whole header\n");
+        return;
+    }
     strncpy(type, buf, 19);
     type[18] = '\0'; // IMPORTANT: this sets it up so we can check our file type easily
     strcat(header, buf);
-    Rio_writen(connfd, buf, n);
 
     // fifth line: \r\n
-    n = Rio_readlineb(&rio_server, buf, MAXLINE); 
-    Rio_writen(connfd, buf, n);
+    if (!relay_line(&rio_server, buf, connfd, &client_ok)) {
+        printf("ERROR: the origin sent no whole header\n");
+        return;
+    }
     strcat(header, buf);
 
     if(!sscanf(size, "Content-length: %s", size)){
@@ -339,65 +376,176 @@ void handle_request(int connfd) {
         return;
     }
 
-    // Read and subsequently write to server:
-    char response[bytes_of_content];
-    Rio_readnb(&rio_server, response, bytes_of_content);
-    Rio_writen(connfd, response, bytes_of_content);
+    // Read the content straight into a new cache object and subsequently write to server:
+    cache_obj_t *obj = cache_obj_new(url, header, bytes_of_content);
+    if (!obj) {
+        printf("ERROR: out of memory\n");
+        return;
+    }
+    if ((n = rio_readnb(&rio_server, obj->content, bytes_of_content)) < 0) {
+        n = 0;
+    }
+    client_ok = client_ok && write_all(connfd, obj->content, n);
+    if (!client_ok) {
+        printf("ERROR: unable to write the response, the client went away\n");
+    }
+
+    // only a complete response is worth caching
+    if ((size_t) n == bytes_of_content) {
+        cache_add(obj);
+    } else {
+        cache_release(obj);
+    }
+}
+
+/* Handles requests sent by the client.
+ * This function parses the request, then it tries to use its cache to resolve it.
+ * It forwards the request to the server and then forwards the response back to the client.
+ * Then, it adds the item to the cache.
+ * An error on either connection only ends this request, it never exits the proxy
+ * ARGUMENT: int connfd - the client's file descriptor
+ */
+void handle_request(int connfd) {
+    // Declaring variables to be passed into subfunctions
+    char buf[MAXLINE], method[MAXLINE], url[MAXLINE], version[MAXLINE], url_trim[MAXLINE]; 
+    char hostname[MAXLINE], port[MAXLINE], resource[MAXLINE];
+
+    /* Read request line and headers */
+    rio_t rio;
+    Rio_readinitb(&rio, connfd); //initalised the connection to read the request
+    // If we cannot read from the client (it closed or reset the connection), we cannot proceed
+    if (rio_readlineb(&rio, buf, MAXLINE) <= 0){ 
+        printf("ERROR: Unable to make a connection using the given fd\n");
+        return;
+    }   
+
+    if (!parse_request(buf, method, url, version, url_trim, resource, port, hostname)) {
+        return;
+    }
 
-    cache_insert(url, header, response, bytes_of_content); 
+    // We have parsed the url that would match the cache. 
+    // From here, we just need to see if we can find it in the cache.
+    if (can_respond_with_cache(url, connfd)) {
+        return;
+    }
 
+    // Forward the request to the server; an origin that can not be reached ends this request
+    int fd_server;
+    if ((fd_server = open_clientfd(hostname, port)) < 0) {
+        printf("ERROR: unable to connect to %s:%s\n", hostname, port);
+        return;
+    }
+    
+    if (send_request(fd_server, resource, buf, hostname, port)) {
+        relay_response(fd_server, connfd, url, buf);
+    } else {
+        printf("ERROR: unable to send the request to the origin\n");
+    }
     Close(fd_server);
 }
 
-/* this is the function called when a new thread is created, it is passed  
- * an int treated as a void* which acts as the file descripter for the newly made 
- * connection between the proxy and the client
+/* this is the function every worker thread runs, it is passed nothing 
  *
- * this fuction simply calls handle_request and specifies multithreaded behavior
+ * a worker takes one accepted connection after the other from the queue, calls 
+ * handle_request on it and closes it, for as long as the proxy runs
  * because this function is called when creating a new thread it must return a void*
- * this function will always return 0 because error handeling is elsewhere
+ * it never returns because error handeling is elsewhere
  */
-void* threadable_main(void *void_connfd){
-    int connfd = (int) void_connfd;
-
+void* worker_main(void *unused){
     Pthread_detach(pthread_self());
-    handle_request(connfd);
-    
-    Close(connfd);
+    while (1) {
+        int connfd = queue_get();
+        handle_request(connfd);
+        Close(connfd);
+    }
     return NULL;
 }
 
-/* this main function calls to initialise and close cache, listens on a listening port 
- * for a new client request and hands it over to a new thread it creates
- * this function assumes that a port number is specified for it to act as a listening port
- * this functon returns 1 if forced to exit beccause there are an incorrect number of 
- * command line arguments and returns 0 otherwise
+/* this main function calls to initialise and close cache, starts a fixed pool of worker 
+ * threads, listens on a listening port for a new client request and queues it for them
+ * this function assumes that a port number is specified for it to act as a listening port,
+ * optionally after the flags
+ *     -t <threads>  number of workers (default THREADS_PER_CORE per core)
+ *     -q <size>     connections that may wait for a worker (default QUEUE_SIZE)
+ *     -r            answer 503 to new clients while the queue is full, instead of
+ *                   waiting for room
+ *     -e            use the event-driven engine of event.c instead of the worker pool,
+ *                   with -t threads (default one per core) that each run an epoll loop
+ * no single connection can end the proxy: when accept runs out of descriptors main waits
+ * for the workers to close some, and errors of a request only end that request
+ * this functon returns 1 if forced to exit beccause the command line arguments are 
+ * incorrect and returns 0 otherwise
  */
 int main(int argc, char **argv) {
     int listenfd, connfd;
-    char hostname[MAXLINE], port[MAXLINE];
     socklen_t clientlen;
     struct sockaddr_storage clientaddr;
-    
-    //initalise a cache for all the threads to share
-    cache_init();
+    long nthreads = THREADS_PER_CORE * sysconf(_SC_NPROCESSORS_ONLN);
+    long queue_size = QUEUE_SIZE;
+    long event_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool reject = false;
+    bool event = false;
+    int c;
 
     /* Check command line args */
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    while ((c = getopt(argc, argv, "t:q:re")) != -1) {
+        switch (c) {
+        case 't': nthreads = atol(optarg); event_threads = nthreads; break;
+        case 'q': queue_size = atol(optarg); break;
+        case 'r': reject = true; break;
+        case 'e': event = true; break;
+        default: nthreads = 0; break;
+        }
+    }
+    if (optind != argc - 1 || nthreads < 1 || queue_size < 1) {
+        fprintf(stderr, "usage: %s [-t <threads>] [-q <queue size>] [-r] [-e] <port>\n", argv[0]);
         exit(1);
     }
+    
+    // a client that goes away must fail a write, not kill the proxy (in either engine)
+    signal(SIGPIPE, SIG_IGN);
+
+    // every connection takes a descriptor, two while it relays
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    //initalise a cache for all the threads to share
+    cache_init();
+    if (event) {
+        event_run(argv[optind], event_threads);
+    }
+    queue_init(queue_size, reject);
 
     pthread_t threadID;
-    listenfd = Open_listenfd(argv[1]);
+    for (long i = 0; i < nthreads; i++) {
+        Pthread_create(&threadID, NULL, worker_main, NULL);
+    }
+
+    listenfd = Open_listenfd(argv[optind]);
     while (1) {
-        // Accept request, split off a thread, and handle the request through threadable_main()
+        // Accept request and queue it for the next free worker
         clientlen = sizeof(clientaddr);
-        connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-        Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
-        Pthread_create(&threadID, NULL, threadable_main, (void *)connfd);
+        if ((connfd = accept(listenfd, (SA *)&clientaddr, &clientlen)) < 0) {
+            // out of descriptors: the client waits in the backlog until a worker closes one
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                usleep(ACCEPT_BACKOFF_US);
+            } else if (errno != EINTR && errno != ECONNABORTED) {
+                printf("ERROR: accept failed: %s\n", strerror(errno));
+            }
+            continue;
+        }
+        if (!queue_put(connfd)) {
+            char *busy = "HTTP/1.0 503 Service Unavailable\r\nContent-length: 0\r\n\r\n";
+            if (write(connfd, busy, strlen(busy)) < 0) {
+                printf("ERROR: unable to turn a client away\n");
+            }
+            Close(connfd);
+        }
     }
 
     cache_free();
     return 0;
-}
\ No newline at end of file
+}
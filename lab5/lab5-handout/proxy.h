@@ -0,0 +1,19 @@
+/**
+ * @file proxy.h
+ *
+ * what proxy.c shares with the event-driven engine in event.c
+ */
+
+#ifndef __PROXY_H__
+#define __PROXY_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+extern char *DEFAULT_PORT;
+extern size_t MAX_ENTRY_SIZE;
+
+bool parse_request(char *buf, char* method, char* url, char* version,
+                   char* url_trim, char* resource, char *port, char*hostname);
+
+#endif /* __PROXY_H__ */